@@ -0,0 +1,190 @@
+#include "defines.h"
+#include "kozos.h"
+#include "timer.h"
+#include "bench.h"
+#include "smp.h"
+#include "shell.h"
+
+static int bench_worker(int argc, char *argv[])
+{
+  return 0;
+}
+
+/*
+ * スレッドの生成と終了を count 回繰り返し，かかった時間(us)を返す．
+ * 生成するスレッドは呼び出し元より優先度を高くしてあるので，kz_run()
+ * から戻る前に終了してスタックとTCBが解放される．
+ */
+uint32 bench_thread(int count)
+{
+  int i, pri;
+  uint32 start;
+
+  pri = kz_chpri(-1); /* 優先度を変えずに現在の優先度を得る */
+  if (pri > 0)
+    pri--;
+
+  start = timer_get();
+  for (i = 0; i < count; i++) {
+    if (kz_run(bench_worker, "bench", pri, 0x100, 0, NULL) == -1)
+      return -1;
+  }
+
+  return timer_get() - start;
+}
+
+static kz_msgbox_id_t bench_msgbox;
+
+/* kz_call() を受けて，そのまま応答を返すサーバ．サイズ0で終了する */
+static int bench_server(int argc, char *argv[])
+{
+  kz_thread_id_t id;
+  int size;
+  char *p;
+
+  do {
+    id = kz_recv(bench_msgbox, &size, &p);
+    kz_reply(id, size, p);
+  } while (size);
+
+  return 0;
+}
+
+/*
+ * kz_call()/kz_reply() による往復を count 回繰り返し，かかった時間(us)を
+ * 返す．サーバは呼び出し元と同じ優先度で動作させるので，実行権の
+ * 直接の引き渡しが無ければ，往復ごとにレディー・キューを一巡する．
+ */
+uint32 bench_call(int count)
+{
+  int i, size;
+  char *p;
+  uint32 start, t;
+
+  bench_msgbox = kz_msgbox_create(0);
+  if (bench_msgbox == -1)
+    return -1;
+  kz_run(bench_server, "bserver", kz_chpri(-1), 0x100, 0, NULL);
+
+  start = timer_get();
+  for (i = 0; i < count; i++) {
+    kz_call(bench_msgbox, 1, "", &size, &p);
+  }
+  t = timer_get() - start;
+
+  kz_call(bench_msgbox, 0, NULL, &size, &p); /* サーバを終了させる */
+  kz_msgbox_destroy(bench_msgbox);
+
+  return t;
+}
+
+#define BENCH_SCALE_WORKERS 8 /* 並列に動作させるスレッドの数 */
+
+static kz_msgbox_id_t bench_scale_msgbox;
+static int bench_scale_count;
+
+/* 計算のみを行い，終了をメッセージで通知するスレッド */
+static int bench_scale_worker(int argc, char *argv[])
+{
+  volatile int i;
+
+  for (i = 0; i < bench_scale_count; i++)
+    ;
+  kz_send(bench_scale_msgbox, 0, NULL);
+
+  return 0;
+}
+
+/*
+ * コア 0〜ncpu-1 で動作するスレッドを BENCH_SCALE_WORKERS 個作成し，
+ * それぞれが count 回のループを終えるまでの時間(us)を返す．
+ * スレッドは呼び出し元のコアで作成され，他のコアにはワーク・スティーリング
+ * によって分散される．
+ */
+uint32 bench_scale(int ncpu, int count)
+{
+  int i, n, size;
+  char *p;
+  uint32 start, t;
+
+  if ((ncpu < 1) || (ncpu > KZ_CPU_NUM))
+    return -1;
+
+  bench_scale_msgbox = kz_msgbox_create(0);
+  if (bench_scale_msgbox == -1)
+    return -1;
+  bench_scale_count = count;
+
+  start = timer_get();
+  n = 0; /* 作成できたスレッドの数 */
+  for (i = 0; i < BENCH_SCALE_WORKERS; i++) {
+    if (kz_run_affinity(bench_scale_worker, "bscale", kz_chpri(-1), 0x100,
+			0, NULL, ((uint32)1 << ncpu) - 1) != -1)
+      n++;
+  }
+  /* 作成できたスレッドの終了のみを待つ */
+  for (i = 0; i < n; i++)
+    kz_recv(bench_scale_msgbox, &size, &p);
+  t = timer_get() - start;
+
+  kz_msgbox_destroy(bench_scale_msgbox);
+
+  if (n < BENCH_SCALE_WORKERS) /* 測定条件を満たさない */
+    return -1;
+
+  return t;
+}
+
+/*
+ * 他のすべてのコアへの再スケジューリングの要求を count 回行う時間(us)を返す．
+ * (受信側までの遅延は lat コマンドの ipi で見る)
+ */
+uint32 bench_ipi(int count)
+{
+  uint32 start;
+  int i;
+
+  start = timer_get();
+  for (i = 0; i < count; i++) {
+    kz_ipi((((uint32)1 << KZ_CPU_NUM) - 1) & ~((uint32)1 << cpu_id()),
+	   IPI_RESCHEDULE);
+  }
+  return timer_get() - start;
+}
+
+/* benchコマンド */
+static int bench_command(int argc, char *argv[])
+{
+  uint32 t;
+  int i;
+
+  shell_write("thread run/exit x 0x100: ");
+  t = bench_thread(0x100);
+  shell_xval(t, 0);
+  shell_write(" us\n");
+
+  shell_write("call/reply x 0x100: ");
+  t = bench_call(0x100);
+  shell_xval(t, 0);
+  shell_write(" us\n");
+
+  for (i = 1; i <= KZ_CPU_NUM; i++) {
+    shell_write("scale cpu ");
+    shell_xval(i, 0);
+    shell_write(": ");
+    t = bench_scale(i, 0x100000);
+    shell_xval(t, 0);
+    shell_write(" us\n");
+  }
+
+#if KZ_CPU_NUM > 1
+  shell_write("ipi x 0x100: ");
+  t = bench_ipi(0x100);
+  shell_xval(t, 0);
+  shell_write(" us\n");
+#endif
+
+  return 0;
+}
+
+SHELL_COMMAND(bench, bench_command, "- kernel micro benchmarks");
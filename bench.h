@@ -0,0 +1,9 @@
+#ifndef _BENCH_H_INCLUDED_
+#define _BENCH_H_INCLUDED_
+
+uint32 bench_thread(int count); /* スレッドの生成/終了 */
+uint32 bench_call(int count);   /* kz_call()/kz_reply()の往復 */
+uint32 bench_scale(int ncpu, int count); /* 複数コアでの並列実行 */
+uint32 bench_ipi(int count);    /* プロセッサ間割込みの送信 */
+
+#endif
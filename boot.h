@@ -0,0 +1,24 @@
+#ifndef _BOOT_H_INCLUDED_
+#define _BOOT_H_INCLUDED_
+
+/*
+ * 起動処理の各段階の時刻(システム・タイマの下位32ビット, us)．
+ * RESET と MAIN は startup.S で記録する．
+ * (アセンブラからも参照するので，定数の定義は __ASSEMBLER__ の外に置く)
+ */
+#define BOOT_STAGE_RESET   0 /* _start の実行開始(ファームウエアの処理時間) */
+#define BOOT_STAGE_MAIN    1 /* BSSのクリアとベクタの設定の後，main() の呼び出し */
+#define BOOT_STAGE_KERNEL  2 /* カーネルの初期化の後，最初のディスパッチ */
+#define BOOT_STAGE_THREAD  3 /* 最初のスレッドの実行開始 */
+#define BOOT_STAGE_CONSOLE 4 /* コマンド・スレッドの実行開始 */
+#define BOOT_STAGE_NUM     5
+
+#ifndef __ASSEMBLER__
+
+extern uint32 boot_stamps[BOOT_STAGE_NUM];
+
+#define boot_stamp(stage) (boot_stamps[stage] = timer_get())
+
+#endif /* __ASSEMBLER__ */
+
+#endif
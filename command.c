@@ -2,51 +2,282 @@
 #include "kozos.h"
 #include "consdrv.h"
 #include "lib.h"
+#include "latency.h"
+#include "smp.h"
+#include "timer.h"
+#include "boot.h"
+#include "loader.h"
+#include "klog.h"
+#include "telemetry.h"
+#include "shell.h"
 
-/* コンソール・ドライバの使用開始をコンソール・ドライバに依頼する */
-static void send_use(int index)
+/* latコマンド(割込みからの遅延のヒストグラム，"lat reset" でクリア) */
+static int lat_command(int argc, char *argv[])
 {
-  char *p;
-  p = kz_kmalloc(3);
-  p[0] = '0';
-  p[1] = CONSDRV_CMD_USE;
-  p[2] = '0' + index;
-  kz_send(MSGBOX_ID_CONSOUTPUT, 3, p);
+  static char *names[LATENCY_NUM] = { "irq", "dispatch", "recv", "ipi" };
+  latency_hist_t hist;
+  int i, j;
+
+  if ((argc > 1) && !strcmp(argv[1], "reset")) { /* ヒストグラムのクリア */
+    latency_reset();
+    return 0;
+  }
+
+  for (i = 0; i < LATENCY_NUM; i++) {
+    latency_get(i, &hist);
+    shell_write(names[i]);
+    shell_write(": count ");
+    shell_xval(hist.count, 0);
+    shell_write(" max ");
+    shell_xval(hist.max, 0);
+    shell_write(" us\n");
+    for (j = 0; j < LATENCY_BIN_NUM; j++) {
+      if (!hist.bins[j])
+	continue;
+      shell_write("  <");
+      shell_xval((uint32)1 << j, 5);
+      shell_write(" us: ");
+      shell_xval(hist.bins[j], 0);
+      shell_write("\n");
+    }
+  }
+
+  return 0;
 }
 
-/* コンソールへの文字列出力をコンソール・ドライバに依頼する */
-static void send_write(char *str)
+/* ipiコマンド(コアごとのプロセッサ間割込みの統計) */
+static int ipi_command(int argc, char *argv[])
 {
-  char *p;
-  int len;
-  len = strlen(str);
-  p = kz_kmalloc(len + 2);
-  p[0] = '0';
-  p[1] = CONSDRV_CMD_WRITE;
-  memcpy(&p[2], str, len);
-  kz_send(MSGBOX_ID_CONSOUTPUT, len + 2, p);
+  ipi_stat_t stat;
+  int i;
+
+  shell_write("CPU REQ      SENT     RECV     RESCHED  TLB      ICACHE\n");
+  for (i = 0; ipi_get_stat(i, &stat) == 0; i++) {
+    shell_xval(i, 3);
+    shell_write(" ");
+    shell_xval(stat.requests, 8);
+    shell_write(" ");
+    shell_xval(stat.sent, 8);
+    shell_write(" ");
+    shell_xval(stat.received, 8);
+    shell_write(" ");
+    shell_xval(stat.reasons[0], 8);
+    shell_write(" ");
+    shell_xval(stat.reasons[1], 8);
+    shell_write(" ");
+    shell_xval(stat.reasons[2], 8);
+    shell_write("\n");
+  }
+
+  return 0;
+}
+
+/*
+ * logコマンド(コアごとのカーネルのログの統計)
+ * "log <n>" で出力するレベルを n(0:ERR〜3:DEBUG) に変更する．
+ */
+static int log_command(int argc, char *argv[])
+{
+  klog_stat_t stat;
+  uint32 level;
+  int i;
+
+  if (argc > 1) {
+    if ((shell_strtoul(argv[1], &level) < 0) || (level >= KLOG_LEVEL_NUM)) {
+      shell_write("log: invalid level.\n");
+      return -1;
+    }
+    shell_write("level ");
+    shell_xval(klog_set_level(level), 0);
+    shell_write(" -> ");
+    shell_xval(level, 0);
+    shell_write("\n");
+    return 0;
+  }
+
+  shell_write("CPU WRITTEN  DROPPED  SUPPRESS\n");
+  for (i = 0; klog_get_stat(i, &stat) == 0; i++) {
+    shell_xval(i, 3);
+    shell_write(" ");
+    shell_xval(stat.written, 8);
+    shell_write(" ");
+    shell_xval(stat.dropped, 8);
+    shell_write(" ");
+    shell_xval(stat.suppressed, 8);
+    shell_write("\n");
+  }
+
+  return 0;
+}
+
+/*
+ * tmコマンド(統計をテレメトリのフレームで送信する)
+ * カウンタの組の識別子は以下で，tools/telemetry_decode.py で表示できる．
+ */
+#define TM_COUNTER_LATENCY 0 /* 区間ごとの計測回数と最大値 */
+#define TM_COUNTER_KLOG    1 /* コア番号と，ログの書き込み/破棄/抑止の数 */
+#define TM_COUNTER_IPI     2 /* コア番号と，IPIの要求/送信/受信の数 */
+
+static int tm_command(int argc, char *argv[])
+{
+  uint32 values[LATENCY_NUM * 2];
+  latency_hist_t hist;
+  klog_stat_t kstat;
+  ipi_stat_t istat;
+  int i;
+
+  for (i = 0; i < LATENCY_NUM; i++) {
+    latency_get(i, &hist);
+    values[i * 2]     = hist.count;
+    values[i * 2 + 1] = hist.max;
+  }
+  telemetry_counters(TM_COUNTER_LATENCY, values, LATENCY_NUM * 2);
+
+  for (i = 0; klog_get_stat(i, &kstat) == 0; i++) {
+    values[0] = i;
+    values[1] = kstat.written;
+    values[2] = kstat.dropped;
+    values[3] = kstat.suppressed;
+    telemetry_counters(TM_COUNTER_KLOG, values, 4);
+  }
+
+  for (i = 0; ipi_get_stat(i, &istat) == 0; i++) {
+    values[0] = i;
+    values[1] = istat.requests;
+    values[2] = istat.sent;
+    values[3] = istat.received;
+    telemetry_counters(TM_COUNTER_IPI, values, 4);
+  }
+
+  return 0;
 }
 
+/*
+ * loadコマンド(シリアル・ローダでアプリケーションを受信して起動する)
+ * 受信中はシリアルを占有して LOADER_BAUD で通信する．
+ */
+static int load_command(int argc, char *argv[])
+{
+  kz_thread_id_t id;
+  int size;
+
+  shell_write("load: send the image with XMODEM-1K at 115200 baud\n");
+  shell_lock(1);
+  size = loader_receive(SERIAL_DEFAULT_DEVICE, LOADER_BAUD);
+  shell_lock(0);
+
+  if (size < 0) {
+    shell_write("load: failed.\n");
+    return -1;
+  }
+
+  id = kz_run((kz_func_t)LOADER_ADDR, "app", 8, 0x1000, 0, NULL);
+  shell_write("load: ");
+  shell_xval(size, 0);
+  shell_write(" bytes, thread ");
+  shell_xval(id, 0);
+  shell_write("\n");
+
+  return 0;
+}
+
+/* bootコマンド(起動処理の各段階の時刻と，前の段階からの経過時間) */
+static int boot_command(int argc, char *argv[])
+{
+  static char *names[BOOT_STAGE_NUM] = {
+    "reset", "main", "kernel", "thread", "console"
+  };
+  int i;
+
+  for (i = 0; i < BOOT_STAGE_NUM; i++) {
+    shell_write(names[i]);
+    shell_write(": ");
+    shell_xval(boot_stamps[i], 8);
+    if (i > 0) {
+      shell_write(" +");
+      shell_xval(boot_stamps[i] - boot_stamps[i - 1], 0);
+    }
+    shell_write(" us\n");
+  }
+
+  return 0;
+}
+
+/* psコマンド(スレッドの一覧とスタック使用量のピーク) */
+static int ps_command(int argc, char *argv[])
+{
+  int i, ret;
+  kz_threadinfo_t info;
+
+  shell_write("ID       PRI STACK USED MISS  OVR NAME\n");
+  for (i = 0; (ret = kz_threadinfo(i, &info)) >= 0; i++) {
+    if (ret == 0) /* 未使用 */
+      continue;
+    shell_xval(info.id, 8);
+    shell_write(" ");
+    shell_xval(info.priority, 3);
+    shell_write(" ");
+    shell_xval(info.stacksize, 5);
+    shell_write(" ");
+    shell_xval(info.stackused, 4);
+    shell_write(" ");
+    shell_xval(info.misses, 4);
+    shell_write(" ");
+    shell_xval(info.overruns, 4);
+    shell_write(" ");
+    shell_write(info.name);
+    shell_write("\n");
+  }
+
+  return 0;
+}
+
+/* echoコマンド(引数を空白で区切って出力する) */
+static int echo_command(int argc, char *argv[])
+{
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (i > 1)
+      shell_write(" ");
+    shell_write(argv[i]);
+  }
+  shell_write("\n");
+
+  return 0;
+}
+
+SHELL_COMMAND(echo, echo_command, "[args...] - print the arguments");
+SHELL_COMMAND(boot, boot_command, "- boot stage timestamps");
+SHELL_COMMAND(ipi, ipi_command, "- inter-processor interrupt statistics");
+SHELL_COMMAND(lat, lat_command, "[reset] - interrupt latency histograms");
+SHELL_COMMAND(load, load_command, "- receive and run an image by XMODEM-1K");
+SHELL_COMMAND(log, log_command, "[level] - kernel log statistics or set the level");
+SHELL_COMMAND(ps, ps_command, "- thread list and stack usage");
+SHELL_COMMAND(tm, tm_command, "- send statistics as telemetry frames");
+
 int command_main(int argc, char *argv[])
 {
   char *p;
   int size;
 
-  send_use(SERIAL_DEFAULT_DEVICE);
+  boot_stamp(BOOT_STAGE_CONSOLE);
+
+  shell_use(SERIAL_DEFAULT_DEVICE);
+  shell_init();
+
+  shell_write("kozos boot succeed!\n");
+  boot_command(0, NULL);
 
   while (1) {
-    send_write("command> "); /* プロンプト表示 */
+    shell_write("command> "); /* プロンプト表示 */
 
     /* コンソールからの受信文字列を受け取る */
     kz_recv(MSGBOX_ID_CONSINPUT, &size, &p);
+    latency_record(LATENCY_RECV, latency_recv_start);
     p[size] = '\0';
 
-    if (!strncmp(p, "echo", 4)) { /* echoコマンド */
-      send_write(p + 4); /* echoに続く文字列を出力する */
-      send_write("\n");
-    } else {
-      send_write("unknown.\n");
-    }
+    shell_exec(p); /* 登録されたコマンドを検索して実行する */
 
     kz_kmfree(p);
   }
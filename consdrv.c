@@ -4,58 +4,310 @@
 #include "interrupt.h"
 #include "serial.h"
 #include "lib.h"
+#include "latency.h"
+#include "smp.h"
+#include "klog.h"
 #include "consdrv.h"
 
-#define CONS_BUFFER_SIZE 24
+KZ_STATIC_ASSERT(KZ_IS_POW2(CONS_SEND_SIZE), "CONS_SEND_SIZE must be a power of 2");
+KZ_STATIC_ASSERT(KZ_IS_POW2(CONS_HISTORY_NUM), "CONS_HISTORY_NUM must be a power of 2");
 
-static struct consreg {
+/*
+ * バッファの大きさとデバイス数は kozos_config.h で定義する．
+ * kozos.c の kz_msgbox と同様の理由で，サイズを２の累乗に切り上げる．
+ */
+typedef KZ_POW2_STRUCT(
   kz_thread_id_t id; /* コンソールを利用するスレッド */
   int index;         /* 利用するシリアルの番号 */
 
-  char *send_buf;    /* 送信バッファ */
-  char *recv_buf;    /* 受信バッファ */
+  char *send_buf;    /* 送信バッファ(リング・バッファ) */
+  char *recv_buf;    /* 受信バッファ(編集中の行) */
+  int send_pos;      /* 送信バッファ中のデータの先頭 */
   int send_len;      /* 送信バッファ中のデータサイズ */
   int recv_len;      /* 受信バッファ中のデータサイズ */
+  char *line_buf;    /* 受信済みの行のバッファ(受信バッファと交互に使う) */
+  int line_len;      /* 受信済みの行のサイズ(-1ならば空き) */
+  uint32 dropped;    /* 通知できずに捨てた行の数 */
+  int locked;        /* スレッドがシリアルを直接使用中 */
+
+  int esc;           /* エスケープ・シーケンスの受信状態 */
+  int hist_head;     /* 履歴に追加した行の数 */
+  int hist_num;      /* 履歴中の行の数 */
+  int hist_pos;      /* 呼び出し中の履歴(何行前か，0ならば呼び出していない) */
+) consreg_t;
+
+static consreg_t consreg[CONSDRV_DEVICE_NUM];
 
-  /* kozos.c の kz_msgbox と同様の理由で，ダミー・メンバでサイズ調整する */
-  long dummy[3];
-} consreg[CONSDRV_DEVICE_NUM];
+/* 各デバイスのバッファ(consreg_t とは分けて，切り上げずに確保する) */
+typedef struct {
+  char send[CONS_SEND_SIZE];
+  char recv[CONS_LINE_SIZE];
+  char line[CONS_LINE_SIZE];
+  char history[CONS_HISTORY_NUM][CONS_LINE_SIZE];
+} consbuf_t;
+
+static consbuf_t consbuf[CONSDRV_DEVICE_NUM];
 
 /*
- * 以下の２つの関数(send_char(), send_string())は割込み処理とスレッドから
- * 呼ばれるが送信バッファを操作しており再入不可のため，スレッドから呼び出す
- * 場合は排他のため割込み禁止状態で呼ぶこと．
+ * 送信処理の排他．
+ * カーネルのログの出力は kprintf() によって任意のコアから開始されるので，
+ * 割込み禁止に加えてスピンロックで排他する．
+ * (ロックの保持中にサービス・コールや kprintf() を呼ばないこと)
  */
+static kz_spinlock_t send_lock;
+#define SEND_LOCK(cpsr)   do { INTR_SAVE(cpsr); spin_lock(&send_lock); } while (0)
+#define SEND_UNLOCK(cpsr) do { spin_unlock(&send_lock); INTR_RESTORE(cpsr); } while (0)
+
+/* カーネルのログを出力するデバイス */
+#define KLOG_CONSREG (&consreg[0])
 
-/* 送信バッファの先頭１文字を送信する */
-static void send_char(struct consreg *cons)
+/*
+ * 以下の関数(send_char(), send_start(), send_string())は割込み処理と
+ * スレッドから呼ばれるが送信バッファを操作しており再入不可のため，
+ * SEND_LOCK() で排他して呼ぶこと．
+ */
+
+/*
+ * 送信バッファの先頭１文字を送信する．
+ * 送信バッファが空ならば，カーネルのログを送信する．
+ * ただしログのレコード(テレメトリのフレームを含む)は途中で切らずに送信し，
+ * 送信バッファの文字はレコードの区切りでのみ挟む．
+ * 送信するものが無ければ-1を返す．
+ */
+static int send_char(consreg_t *cons)
 {
-  int i;
-  serial_send_byte(cons->index, cons->send_buf[0]);
-  cons->send_len--;
-  /* 先頭文字を送信したので，１文字ぶんずらす */
-  for (i = 0; i < cons->send_len; i++)
-    cons->send_buf[i] = cons->send_buf[i + 1];
+  int c;
+
+  if ((cons == KLOG_CONSREG) && klog_in_record()) {
+    serial_send_byte(cons->index, klog_getc());
+    return 0;
+  }
+
+  if (cons->send_len) {
+    serial_send_byte(cons->index, cons->send_buf[cons->send_pos]);
+    cons->send_pos = (cons->send_pos + 1) & (CONS_SEND_SIZE - 1);
+    cons->send_len--;
+    return 0;
+  }
+
+  if ((cons == KLOG_CONSREG) && ((c = klog_getc()) >= 0)) {
+    serial_send_byte(cons->index, c);
+    return 0;
+  }
+
+  return -1;
+}
+
+/*
+ * 送信割込み無効ならば，送信開始されていないので送信開始する．
+ * 送信割込み有効ならば送信開始されており，送信割込みの延長で
+ * 送信バッファ内のデータが順次送信されるので，何もしなくてよい．
+ */
+static void send_start(consreg_t *cons)
+{
+  if (!serial_intr_is_send_enable(cons->index)) {
+    serial_intr_send_enable(cons->index); /* 送信割込み有効化 */
+    if (send_char(cons) < 0) /* 送信開始 */
+      serial_intr_send_disable(cons->index);
+  }
+}
+
+/*
+ * 送信バッファに１文字書き込む．
+ * 一杯ならば，送信できるまで待って先頭の文字を直接送信する．
+ * (送信バッファの大きさは通常の出力では一杯にならないように決めておく)
+ */
+static void send_put(consreg_t *cons, char c)
+{
+  while (cons->send_len == CONS_SEND_SIZE) {
+    while (!serial_is_send_enable(cons->index))
+      ;
+    send_char(cons);
+  }
+  cons->send_buf[(cons->send_pos + cons->send_len) & (CONS_SEND_SIZE - 1)] = c;
+  cons->send_len++;
 }
 
 /* 文字列を送信バッファに書き込み送信開始する */
-static void send_string(struct consreg *cons, char *str, int len)
+static void send_string(consreg_t *cons, char *str, int len)
 {
   int i;
   for (i = 0; i < len; i++) { /* 文字列を送信バッファにコピー */
     if (str[i] == '\n') /* \n→\r\nに変換 */
-      cons->send_buf[cons->send_len++] = '\r';
-    cons->send_buf[cons->send_len++] = str[i];
+      send_put(cons, '\r');
+    send_put(cons, str[i]);
   }
-  /*
-   * 送信割込み無効ならば，送信開始されていないので送信開始する．
-   * 送信割込み有効ならば送信開始されており，送信割込みの延長で
-   * 送信バッファ内のデータが順次送信されるので，何もしなくてよい．
-   */
-  if (cons->send_len && !serial_intr_is_send_enable(cons->index)) {
-    serial_intr_send_enable(cons->index); /* 送信割込み有効化 */
-    send_char(cons); /* 送信開始 */
+  send_start(cons);
+}
+
+/*
+ * カーネルのログの出力開始．
+ * kprintf() から任意のコンテキストで呼ばれる．(klog_set_kick()で登録する)
+ * 使用開始前と，スレッドがシリアルを占有中は何もしない．
+ * (ログはバッファに残り，使用開始時と占有の解除時に出力される)
+ */
+static void consdrv_kick(void)
+{
+  consreg_t *cons = KLOG_CONSREG;
+  uint32 cpsr;
+
+  SEND_LOCK(cpsr);
+  if (cons->id && !cons->locked)
+    send_start(cons);
+  SEND_UNLOCK(cpsr);
+}
+
+/* 通知できなかった行を数えて，頻度制限付きでログに残す */
+static void consdrv_drop(consreg_t *cons, const char *reason)
+{
+  cons->dropped++;
+  kprintf_ratelimited(KLOG_WARN, "consdrv: line dropped (%s, total %u)\n",
+		      reason, cons->dropped);
+}
+
+/*
+ * 受信済みの行をコマンド処理スレッドに通知する．
+ * (割込みハンドラから登録される遅延処理であり，割込み許可で実行される)
+ */
+static void consdrv_deliver(void *arg)
+{
+  consreg_t *cons = arg;
+  char *p;
+
+  p = kx_kmalloc(cons->line_len + 1); /* 受信側で終端を付けられるように */
+  if (p == NULL) {
+    consdrv_drop(cons, "no memory");
+  } else {
+    memcpy(p, cons->line_buf, cons->line_len);
+    kx_send(MSGBOX_ID_CONSINPUT, cons->line_len, p);
+  }
+  cons->line_len = -1; /* 行のバッファを空ける */
+}
+
+/*
+ * 行の編集．(以下の関数は受信割込みから SEND_LOCK() で排他して呼ぶ)
+ * 受信バッファは CONS_LINE_SIZE - 1 文字までで，それ以上はベルを鳴らして
+ * 捨てる．(行の末尾には受信側で終端を付ける)
+ * 以下のキーを扱い，その他の制御文字は無視する．
+ *   BS, DEL : １文字削除
+ *   Ctrl-U  : 行の削除
+ *   ↑, ↓   : 履歴の呼び出し(ESC [ A, ESC [ B)
+ */
+
+/* 編集中の行を画面から消す */
+static void edit_erase(consreg_t *cons)
+{
+  int i;
+  if (!cons->recv_len)
+    return;
+  for (i = 0; i < cons->recv_len; i++)
+    send_put(cons, '\b');
+  send_string(cons, "\033[K", 3); /* カーソルから行末までを消去 */
+  cons->recv_len = 0;
+}
+
+/* n行前の履歴を編集中の行にする(0ならば空の行にする) */
+static void edit_recall(consreg_t *cons, int n)
+{
+  char *line;
+
+  edit_erase(cons);
+  cons->hist_pos = n;
+  if (!n)
+    return;
+
+  line = consbuf[cons - consreg].history[(cons->hist_head - n) &
+					 (CONS_HISTORY_NUM - 1)];
+  cons->recv_len = strlen(line);
+  memcpy(cons->recv_buf, line, cons->recv_len);
+  send_string(cons, cons->recv_buf, cons->recv_len);
+}
+
+/* 確定した行を履歴に追加する(空の行と，直前と同じ行は追加しない) */
+static void edit_history(consreg_t *cons)
+{
+  char *line;
+
+  cons->hist_pos = 0;
+  if (!cons->recv_len)
+    return;
+
+  line = consbuf[cons - consreg].history[(cons->hist_head - 1) &
+					 (CONS_HISTORY_NUM - 1)];
+  if (cons->hist_num && (strlen(line) == cons->recv_len) &&
+      !memcmp(line, cons->recv_buf, cons->recv_len))
+    return;
+
+  line = consbuf[cons - consreg].history[cons->hist_head &
+					 (CONS_HISTORY_NUM - 1)];
+  memcpy(line, cons->recv_buf, cons->recv_len);
+  line[cons->recv_len] = '\0';
+  cons->hist_head++;
+  if (cons->hist_num < CONS_HISTORY_NUM)
+    cons->hist_num++;
+}
+
+/* エスケープ・シーケンスの処理(ESC [ の後は終端文字まで読み捨てる) */
+static void edit_escape(consreg_t *cons, unsigned char c)
+{
+  if (cons->esc == 1) {
+    cons->esc = (c == '[') ? 2 : 0;
+    return;
   }
+  if ((c < 0x40) || (c > 0x7e)) /* 引数ならば，終端文字を待つ */
+    return;
+  cons->esc = 0;
+
+  if ((c == 'A') && (cons->hist_pos < cons->hist_num))
+    edit_recall(cons, cons->hist_pos + 1);
+  else if ((c == 'B') && (cons->hist_pos > 0))
+    edit_recall(cons, cons->hist_pos - 1);
+}
+
+/* １文字を処理する．行が確定したら1を返す */
+static int edit_char(consreg_t *cons, unsigned char c)
+{
+  if (cons->esc) {
+    edit_escape(cons, c);
+    return 0;
+  }
+
+  switch (c) {
+  case '\r':
+  case '\n':
+    send_string(cons, "\n", 1);
+    edit_history(cons);
+    return 1;
+
+  case '\b':
+  case 0x7f:
+    if (cons->recv_len) {
+      cons->recv_len--;
+      send_string(cons, "\b \b", 3);
+    }
+    break;
+
+  case 0x15: /* Ctrl-U */
+    edit_erase(cons);
+    break;
+
+  case 0x1b: /* ESC */
+    cons->esc = 1;
+    break;
+
+  default:
+    if (c < 0x20)
+      break;
+    if (cons->recv_len < CONS_LINE_SIZE - 1) {
+      cons->recv_buf[cons->recv_len++] = c;
+      send_string(cons, (char *)&c, 1); /* エコーバック処理 */
+    } else {
+      send_string(cons, "\a", 1); /* 行が一杯 */
+    }
+    break;
+  }
+
+  return 0;
 }
 
 /*
@@ -68,44 +320,58 @@ static void send_string(struct consreg *cons, char *str, int len)
  * また非コンテキスト状態で呼ばれるため，システム・コールは利用してはいけない．
  * (サービス・コールを利用すること)
  */
-static int consdrv_intrproc(struct consreg *cons)
+static int consdrv_intrproc(consreg_t *cons)
 {
   unsigned char c;
   char *p;
+  uint32 cpsr;
+  int done;
 
   if (serial_is_recv_enable(cons->index)) { /* 受信割込み */
     c = serial_recv_byte(cons->index);
-    if (c == '\r') /* 改行コード変換(\r→\n) */
-      c = '\n';
 
-    send_string(cons, &c, 1); /* エコーバック処理 */
+    SEND_LOCK(cpsr);
+    done = edit_char(cons, c); /* 行の編集とエコーバック処理 */
+    SEND_UNLOCK(cpsr);
 
-    if (cons->id) {
-      if (c != '\n') {
-	/* 改行でないなら，受信バッファにバッファリングする */
-	cons->recv_buf[cons->recv_len++] = c;
-      } else {
+    if (done) {
+      if (cons->line_len < 0) {
 	/*
-	 * Enterが押されたら，バッファの内容を
-	 * コマンド処理スレッドに通知する．
-	 * (割込みハンドラなので，サービス・コールを利用する)
+	 * Enterが押されたら，受信バッファを行のバッファと入れ替えて，
+	 * コマンド処理スレッドへの通知は遅延処理で行う．
+	 * (割込みハンドラの中ではメモリ確保やメッセージ送信をしない)
 	 */
-	p = kx_kmalloc(CONS_BUFFER_SIZE);
-	memcpy(p, cons->recv_buf, cons->recv_len);
-	kx_send(MSGBOX_ID_CONSINPUT, cons->recv_len, p);
+	p = cons->line_buf;
+	cons->line_buf = cons->recv_buf;
+	cons->line_len = cons->recv_len;
+	cons->recv_buf = p;
 	cons->recv_len = 0;
+	latency_recv_start = latency_irq_start[cpu_id()]; /* 遅延の計測用 */
+	if (kx_defer(consdrv_deliver, cons) < 0) {
+	  cons->line_len = -1; /* キューが一杯ならば行を捨てる */
+	  consdrv_drop(cons, "defer queue full");
+	}
+      } else {
+	/* 前の行がまだ通知されていないならば，行を捨てる */
+	cons->recv_len = 0;
+	consdrv_drop(cons, "line pending");
       }
     }
   }
 
   if (serial_is_send_enable(cons->index)) { /* 送信割込み */
-    if (!cons->id || !cons->send_len) {
-      /* 送信データが無いならば，送信処理終了 */
+    SEND_LOCK(cpsr);
+    /*
+     * 送信データがあるならば引続き送信し，無いならば送信処理終了．
+     * 送信FIFOに空きがある限り詰めて，割込みの回数を減らす．
+     */
+    if (!cons->id || (send_char(cons) < 0)) {
       serial_intr_send_disable(cons->index);
     } else {
-      /* 送信データがあるならば，引続き送信する */
-      send_char(cons);
+      while (serial_is_send_enable(cons->index) && (send_char(cons) == 0))
+	;
     }
+    SEND_UNLOCK(cpsr);
   }
 
   return 0;
@@ -115,7 +381,7 @@ static int consdrv_intrproc(struct consreg *cons)
 static void consdrv_intr(void)
 {
   int i;
-  struct consreg *cons;
+  consreg_t *cons;
 
   for (i = 0; i < CONSDRV_DEVICE_NUM; i++) {
     cons = &consreg[i];
@@ -128,36 +394,64 @@ static void consdrv_intr(void)
   }
 }
 
-static int consdrv_init(void)
-{
-  memset(consreg, 0, sizeof(consreg));
-  return 0;
-}
-
 /* スレッドからの要求を処理する */
-static int consdrv_command(struct consreg *cons, kz_thread_id_t id,
+static int consdrv_command(consreg_t *cons, kz_thread_id_t id,
 			   int index, int size, char *command)
 {
+  uint32 cpsr;
+
   switch (command[0]) {
   case CONSDRV_CMD_USE: /* コンソール・ドライバの使用開始 */
     cons->id = id;
     cons->index = command[1] - '0';
-    cons->send_buf = kz_kmalloc(CONS_BUFFER_SIZE);
-    cons->recv_buf = kz_kmalloc(CONS_BUFFER_SIZE);
+    cons->send_buf = consbuf[index].send;
+    cons->recv_buf = consbuf[index].recv;
+    cons->line_buf = consbuf[index].line;
+    cons->line_len = -1;
+    cons->send_pos = 0;
     cons->send_len = 0;
     cons->recv_len = 0;
     serial_init(cons->index);
     serial_intr_recv_enable(cons->index); /* 受信割込み有効化(受信開始) */
+    if (cons == KLOG_CONSREG)
+      consdrv_kick(); /* 使用開始前に書き込まれたログを出力する */
     break;
 
   case CONSDRV_CMD_WRITE: /* コンソールへの文字列出力 */
+    if (cons->locked) /* 占有中の出力は捨てる */
+      break;
     /*
      * send_string()では送信バッファを操作しており再入不可なので，
-     * 排他のために割込み禁止にして呼び出す．
+     * 排他して呼び出す．
      */
-    INTR_DISABLE;
+    SEND_LOCK(cpsr);
     send_string(cons, command + 1, size - 1); /* 文字列の送信 */
-    INTR_ENABLE;
+    SEND_UNLOCK(cpsr);
+    break;
+
+  case CONSDRV_CMD_LOCK: /* シリアルの占有(kz_call()で要求される) */
+    if (command[1] == '1') {
+      /*
+       * 送信バッファに残っている文字を出力し切ってから，割込みを止める．
+       * 以降は要求したスレッドがシリアルを直接(ポーリングで)操作する．
+       */
+      SEND_LOCK(cpsr);
+      while (cons->send_len) {
+	while (!serial_is_send_enable(cons->index))
+	  ;
+	send_char(cons);
+      }
+      serial_intr_send_disable(cons->index);
+      serial_intr_recv_disable(cons->index);
+      cons->recv_len = 0;
+      cons->locked = 1;
+      SEND_UNLOCK(cpsr);
+    } else {
+      cons->locked = 0;
+      serial_intr_recv_enable(cons->index);
+      consdrv_kick(); /* 占有中に溜まったログを出力する */
+    }
+    kz_reply(id, 0, NULL);
     break;
 
   default:
@@ -173,8 +467,12 @@ int consdrv_main(int argc, char *argv[])
   kz_thread_id_t id;
   char *p;
 
-  consdrv_init();
+  /*
+   * consreg[] はBSSなのでクリア済み．各デバイスのバッファの獲得と
+   * シリアルの初期化は，CONSDRV_CMD_USE で使用開始されるまで行わない．
+   */
   kz_setintr(SOFTVEC_TYPE_SERINTR, consdrv_intr); /* 割込みハンドラ設定 */
+  klog_set_kick(consdrv_kick); /* カーネルのログの出力を引き受ける */
 
   while (1) {
     id = kz_recv(MSGBOX_ID_CONSOUTPUT, &size, &p);
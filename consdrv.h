@@ -1,8 +1,8 @@
 #ifndef _CONSDRV_H_INCLUDED_
 #define _CONSDRV_H_INCLUDED_
 
-#define CONSDRV_DEVICE_NUM 1
 #define CONSDRV_CMD_USE   'u' /* コンソール・ドライバの使用開始 */
 #define CONSDRV_CMD_WRITE 'w' /* コンソールへの文字列出力 */
+#define CONSDRV_CMD_LOCK  'l' /* シリアルの占有の開始('1')/終了('0') */
 
 #endif
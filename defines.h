@@ -1,21 +1,92 @@
 #ifndef _DEFINES_H_INCLUDED_
 #define _DEFINES_H_INCLUDED_
 
+#include "kozos_config.h"
+
 #define NULL ((void *)0)
 #define SERIAL_DEFAULT_DEVICE 1
 
+/* コンパイル時の検査(条件が成り立たなければコンパイル・エラーになる) */
+#define KZ_STATIC_ASSERT(cond, msg) _Static_assert(cond, msg)
+
+/* n が2の累乗か，n 以上の最小の2の累乗(いずれも定数式になる) */
+#define KZ_IS_POW2(n) ((n) && !((n) & ((n) - 1)))
+#define KZ__OR_SHR(x, s) ((x) | ((x) >> (s)))
+#define KZ_ROUNDUP_POW2(n) \
+  (KZ__OR_SHR(KZ__OR_SHR(KZ__OR_SHR(KZ__OR_SHR(KZ__OR_SHR( \
+    (uint32)(n) - 1, 1), 2), 4), 8), 16) + 1)
+
+/*
+ * 配列にする構造体を，サイズが2の累乗になるように共用体で包んで定義する．
+ * H8のような乗算命令の無いCPUでも，配列のインデックス計算がシフトで済む．
+ * (以前はダミー・メンバで調整していたが，メンバの追加のたびに
+ * 手で合わせる必要があった)
+ */
+#define KZ_POW2_STRUCT(...) \
+  union { \
+    struct { __VA_ARGS__ }; \
+    char kz_pow2_pad[KZ_ROUNDUP_POW2(sizeof(struct { __VA_ARGS__ }))]; \
+  }
+
+/*
+ * 頻繁に実行される関数を .text.hot セクションにまとめて配置する．
+ * (キャッシュとTLBに載りやすくする．ld.scr を参照)
+ */
+#define KZ_HOT __attribute__((section(".text.hot")))
+
 typedef unsigned char  uint8;
 typedef unsigned short uint16;
 typedef unsigned long  uint32;
 
 typedef uint32 kz_thread_id_t;
+typedef int kz_ring_id_t;
+typedef int kz_sem_id_t;
+typedef int kz_mutex_id_t;
+typedef int kz_flag_id_t;
 typedef int (*kz_func_t)(int argc, char *argv[]);
 typedef void (*kz_handler_t)(void);
+typedef void (*kz_defer_t)(void *arg); /* 割込みの遅延処理 */
 
-typedef enum {
+/* kz_run_affinity() で指定する，動作可能なコアのビットマップ */
+#define KZ_AFFINITY_ANY 0xffffffff /* すべてのコア */
+
+/*
+ * 静的に割り当てられるメッセージ・ボックス．
+ * MSGBOX_ID_NUM 以降のIDは kz_msgbox_create() で動的に割り当てられる．
+ * (IDは他のカーネル・オブジェクトと同様に int で，エラーは-1とする．
+ * 列挙型の符号の有無は処理系定義なので，型には使わない)
+ */
+typedef int kz_msgbox_id_t;
+enum {
   MSGBOX_ID_CONSINPUT = 0,
   MSGBOX_ID_CONSOUTPUT,
   MSGBOX_ID_NUM
-} kz_msgbox_id_t;
+};
+
+/* kz_sendv()/kz_recvv() で受け渡すメッセージ */
+typedef struct {
+  kz_thread_id_t id; /* 送信元スレッド(受信時に設定される) */
+  int size;
+  char *p;
+} kz_msgvec_t;
+
+/* kz_threadinfo() で取得するスレッド情報 */
+typedef struct {
+  kz_thread_id_t id;
+  char name[16];
+  int priority;
+  int stacksize; /* スタックのサイズ */
+  int stackused; /* スタック使用量のピーク */
+  uint32 misses;   /* EDF: デッドライン・ミスの回数 */
+  uint32 overruns; /* EDF: 予算超過の回数 */
+} kz_threadinfo_t;
+
+/* kz_msgbox_create() で指定するメッセージ・ボックスの属性 */
+#define KZ_MSGBOX_ATTR_PRIORITY (1 << 0) /* 優先度順の配送と優先度継承 */
+
+/* kz_flag_wait() で指定する待ち合わせ条件 */
+#define KZ_FLAG_WAIT_AND   0        /* 指定したビットがすべてセット */
+#define KZ_FLAG_WAIT_OR    (1 << 0) /* 指定したビットのいずれかがセット */
+#define KZ_FLAG_WAIT_CLEAR (1 << 1) /* 待ち合わせ成立時に指定ビットをクリア */
 
 #endif
@@ -1,6 +1,28 @@
 #include "defines.h"
 #include "intr.h"
 #include "interrupt.h"
+#include "rpi_peripherals.h"
+
+/* ソフトウエア・割込みベクタは ld.scr の softvec 領域(0x40バイト)に置く */
+KZ_STATIC_ASSERT(SOFTVEC_TYPE_NUM * sizeof(softvec_handler_t) <= 0x40,
+		 "SOFTVEC_TYPE_NUM does not fit in the softvec area");
+
+/* IRQごとのソフトウエア・割込みベクタ */
+static softvec_type_t irq_types[INTR_IRQ_NUM];
+
+/* 優先度ごとのIRQのビットマップ(IRQ0〜31, IRQ32〜63) */
+static uint32 irq_prio[INTR_PRIORITY_NUM][2];
+
+/* 有効化されたIRQと，優先度によってマスク中のIRQ(割込みコントローラの写し) */
+static uint32 irq_enabled[2];
+static uint32 irq_masked[2];
+
+/*
+ * ネストした割込みごとに，マスクする前の状態を保存する．
+ * ネストは優先度の高い割込みでのみ発生するので，段数は優先度の数以下．
+ */
+static uint32 irq_save[INTR_PRIORITY_NUM][2];
+static int irq_nest;
 
 /* ソフトウエア・割込みベクタの初期化 */
 int softvec_init(void)
@@ -18,11 +40,130 @@ int softvec_setintr(softvec_type_t type, softvec_handler_t handler)
   return 0;
 }
 
+/* IRQの有効化(割込み番号，ソフトウエア・割込みベクタ，優先度) */
+int intr_enable_irq(int irq, softvec_type_t type, int priority)
+{
+  uint32 cpsr, bit;
+  int i, n;
+
+  if ((irq < 0) || (irq >= INTR_IRQ_NUM) ||
+      (priority < 0) || (priority >= INTR_PRIORITY_NUM))
+    return -1;
+
+  n = irq >> 5;
+  bit = (uint32)1 << (irq & 31);
+
+  INTR_SAVE(cpsr);
+  irq_types[irq] = type;
+  for (i = 0; i < INTR_PRIORITY_NUM; i++)
+    irq_prio[i][n] &= ~bit;
+  irq_prio[priority][n] |= bit;
+  irq_enabled[n] |= bit;
+  if (!(irq_masked[n] & bit)) {
+    if (n)
+      *INTERRUPT_ENABLE_IRQS2 = bit;
+    else
+      *INTERRUPT_ENABLE_IRQS1 = bit;
+  }
+  INTR_RESTORE(cpsr);
+
+  return 0;
+}
+
+/* IRQの無効化 */
+int intr_disable_irq(int irq)
+{
+  uint32 cpsr, bit;
+  int i, n;
+
+  if ((irq < 0) || (irq >= INTR_IRQ_NUM))
+    return -1;
+
+  n = irq >> 5;
+  bit = (uint32)1 << (irq & 31);
+
+  INTR_SAVE(cpsr);
+  for (i = 0; i < INTR_PRIORITY_NUM; i++)
+    irq_prio[i][n] &= ~bit;
+  irq_enabled[n] &= ~bit;
+  if (n)
+    *INTERRUPT_DISABLE_IRQS2 = bit;
+  else
+    *INTERRUPT_DISABLE_IRQS1 = bit;
+  INTR_RESTORE(cpsr);
+
+  return 0;
+}
+
+/*
+ * 処理すべきIRQを選んで，それと同じ優先度以下のIRQをマスクする．
+ * (割込み禁止状態で呼ぶこと．この後に割込みを許可しても，
+ * より優先度の高いIRQのみが発生する)
+ */
+KZ_HOT softvec_type_t intr_irq_enter(void)
+{
+  uint32 pending[2], mask[2], bits = 0;
+  int pri, n = 0, irq;
+
+  pending[0] = *INTERRUPT_IRQ_PENDING1 & irq_enabled[0] & ~irq_masked[0];
+  pending[1] = *INTERRUPT_IRQ_PENDING2 & irq_enabled[1] & ~irq_masked[1];
+
+  /* 優先度の高い順に，発生しているIRQを探す */
+  for (pri = 0; pri < INTR_PRIORITY_NUM; pri++) {
+    for (n = 0; n < 2; n++) {
+      bits = pending[n] & irq_prio[pri][n];
+      if (bits)
+	break;
+    }
+    if (bits)
+      break;
+  }
+  if (!bits) /* 見つからなかった */
+    return -1;
+  irq = (n << 5) + __builtin_ctz(bits);
+
+  /* 同じ優先度以下のIRQをマスクする */
+  mask[0] = mask[1] = 0;
+  for (; pri < INTR_PRIORITY_NUM; pri++) {
+    mask[0] |= irq_prio[pri][0];
+    mask[1] |= irq_prio[pri][1];
+  }
+  mask[0] &= ~irq_masked[0];
+  mask[1] &= ~irq_masked[1];
+
+  irq_save[irq_nest][0] = irq_masked[0];
+  irq_save[irq_nest][1] = irq_masked[1];
+  irq_nest++;
+
+  *INTERRUPT_DISABLE_IRQS1 = mask[0];
+  *INTERRUPT_DISABLE_IRQS2 = mask[1];
+  irq_masked[0] |= mask[0];
+  irq_masked[1] |= mask[1];
+
+  return irq_types[irq];
+}
+
+/* intr_irq_enter() でマスクしたIRQを元に戻す(割込み禁止状態で呼ぶこと) */
+KZ_HOT void intr_irq_leave(void)
+{
+  uint32 unmask[2];
+
+  irq_nest--;
+  unmask[0] = irq_masked[0] & ~irq_save[irq_nest][0];
+  unmask[1] = irq_masked[1] & ~irq_save[irq_nest][1];
+  irq_masked[0] = irq_save[irq_nest][0];
+  irq_masked[1] = irq_save[irq_nest][1];
+
+  /* マスク中に無効化されたIRQは有効にしない */
+  *INTERRUPT_ENABLE_IRQS1 = unmask[0] & irq_enabled[0];
+  *INTERRUPT_ENABLE_IRQS2 = unmask[1] & irq_enabled[1];
+}
+
 /*
  * 共通割込みハンドラ．
  * ソフトウエア・割込みベクタを見て，各ハンドラに分岐する．
  */
-void interrupt(softvec_type_t type, unsigned long sp)
+KZ_HOT void interrupt(softvec_type_t type, unsigned long sp)
 {
   softvec_handler_t handler = SOFTVECS[type];
   if (handler)
@@ -17,12 +17,44 @@ typedef void (*softvec_handler_t)(softvec_type_t type, unsigned long sp);
 #define INTR_ENABLE  asm volatile ("cpsie i")
 #define INTR_DISABLE asm volatile ("cpsid i")
 
+/*
+ * 割込み禁止状態を保存して割込み禁止にする/保存した状態に戻す．
+ * (割込みハンドラの内部からも呼ばれる処理の排他に使う)
+ */
+#define INTR_SAVE(cpsr) \
+  asm volatile ("mrs %0, cpsr\n\tcpsid i" : "=r" (cpsr) : : "memory")
+#define INTR_RESTORE(cpsr) \
+  asm volatile ("msr cpsr_c, %0" : : "r" (cpsr) : "memory")
+
+/*
+ * 割込みコントローラの割込み番号(IRQ)と優先度．
+ * 優先度は数値が小さいほど高い．ハンドラの実行中は，それより高い優先度の
+ * 割込みのみを受け付ける．
+ */
+#define INTR_IRQ_NUM      64
+#define INTR_PRIORITY_NUM 4
+
 /* ソフトウエア・割込みベクタの初期化 */
 int softvec_init(void);
 
 /* ソフトウエア・割込みベクタの設定 */
 int softvec_setintr(softvec_type_t type, softvec_handler_t handler);
 
+/* IRQの有効化(割込み番号，ソフトウエア・割込みベクタ，優先度) */
+int intr_enable_irq(int irq, softvec_type_t type, int priority);
+
+/* IRQの無効化 */
+int intr_disable_irq(int irq);
+
+/*
+ * 処理すべきIRQを選んで，それと同じ優先度以下のIRQをマスクする．
+ * ソフトウエア・割込みベクタの番号を返す(要因が無い場合は-1)
+ */
+softvec_type_t intr_irq_enter(void);
+
+/* intr_irq_enter() でマスクしたIRQを元に戻す */
+void intr_irq_leave(void);
+
 /* 共通割込みハンドラ */
 void interrupt(softvec_type_t type, unsigned long sp);
 
@@ -3,10 +3,12 @@
 
 /* ソフトウエア・割込みベクタの定義 */
 
-#define SOFTVEC_TYPE_NUM     3
+#define SOFTVEC_TYPE_NUM     5
 
 #define SOFTVEC_TYPE_SOFTERR 0
 #define SOFTVEC_TYPE_SYSCALL 1
 #define SOFTVEC_TYPE_SERINTR 2
+#define SOFTVEC_TYPE_IRQ     3 /* IRQ(割込みコントローラで要因を判別する) */
+#define SOFTVEC_TYPE_TIMINTR 4 /* ティック・タイマ */
 
 #endif
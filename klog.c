@@ -0,0 +1,309 @@
+#include "defines.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "smp.h"
+#include "lib.h"
+#include "klog.h"
+
+KZ_STATIC_ASSERT(KZ_IS_POW2(KLOG_BUF_SIZE), "KLOG_BUF_SIZE must be a power of 2");
+KZ_STATIC_ASSERT(KLOG_LINE_SIZE <= KLOG_RECORD_SIZE, "KLOG_LINE_SIZE too large");
+KZ_STATIC_ASSERT(KLOG_RECORD_SIZE < KLOG_BUF_SIZE, "KLOG_BUF_SIZE too small");
+
+/*
+ * ログのリング・バッファ(コアごと)．
+ * head は書き込むコアのみが，tail は読み出し側のみが更新するので，
+ * 書き込みと読み出しの間にロックは不要．
+ * (head と tail は剰余をとらずに増やし続け，差分をデータ量とする)
+ * メッセージは先頭に長さ(1バイト)を付けたレコードとして書き込む．
+ */
+typedef struct {
+  char buf[KLOG_BUF_SIZE];
+  volatile uint32 head; /* 書き込み位置 */
+  volatile uint32 tail; /* 読み出し位置 */
+  klog_stat_t stat;
+} klog_ring_t;
+
+static klog_ring_t klog_rings[KZ_CPU_NUM];
+static int klog_read_cpu; /* 読み出し中のバッファ */
+static int klog_remain;   /* 読み出し中のレコードの残りの長さ */
+static int klog_level = KLOG_LEVEL;
+static void (*klog_kick)(void);
+
+static const uint32 klog_pow10[] = {
+  1000000000, 100000000, 10000000, 1000000, 100000,
+  10000, 1000, 100, 10, 1,
+};
+
+/*
+ * １文字を追加する(\n→\r\nに変換し，入りきらない文字は捨てる)．
+ * 長すぎるメッセージでも改行は出力できるように，末尾の２文字は改行用に残す．
+ */
+static int klog_emit(char *buf, int len, char c)
+{
+  if (c == '\n') {
+    if (len + 2 > KLOG_LINE_SIZE)
+      return len;
+    buf[len++] = '\r';
+  } else if (len + 3 > KLOG_LINE_SIZE) {
+    return len;
+  }
+  buf[len++] = c;
+  return len;
+}
+
+/* 数値を文字列に変換する(10進は割算を使わず，各桁の重みを引いて求める) */
+static int klog_utoa(char *s, uint32 value, int hex)
+{
+  int i, d, n = 0;
+
+  if (hex) {
+    for (i = 28; i >= 0; i -= 4) {
+      d = (value >> i) & 0xf;
+      if (n || d || !i)
+	s[n++] = "0123456789abcdef"[d];
+    }
+  } else {
+    for (i = 0; i < 10; i++) {
+      for (d = 0; value >= klog_pow10[i]; d++)
+	value -= klog_pow10[i];
+      if (n || d || (i == 9))
+	s[n++] = '0' + d;
+    }
+  }
+  return n;
+}
+
+/* 書式化して，書き込んだ長さを返す */
+static int klog_format(char *buf, const char *fmt, __builtin_va_list ap)
+{
+  char num[10], *s, pad;
+  int len = 0, width, n, neg;
+  uint32 value;
+
+  for (; *fmt; fmt++) {
+    if (*fmt != '%') {
+      len = klog_emit(buf, len, *fmt);
+      continue;
+    }
+    fmt++;
+    pad = ' ';
+    if (*fmt == '0') {
+      pad = '0';
+      fmt++;
+    }
+    for (width = 0; (*fmt >= '0') && (*fmt <= '9'); fmt++)
+      width = width * 10 + (*fmt - '0');
+    if (*fmt == 'l') /* int と long は同じ大きさ */
+      fmt++;
+
+    s = num;
+    neg = 0;
+    switch (*fmt) {
+    case 'd':
+      value = __builtin_va_arg(ap, int);
+      if ((int)value < 0) {
+	neg = 1;
+	value = -value;
+      }
+      n = klog_utoa(num, value, 0);
+      break;
+    case 'u':
+      n = klog_utoa(num, __builtin_va_arg(ap, unsigned int), 0);
+      break;
+    case 'x':
+      n = klog_utoa(num, __builtin_va_arg(ap, unsigned int), 1);
+      break;
+    case 'p':
+      n = klog_utoa(num, (uint32)__builtin_va_arg(ap, void *), 1);
+      break;
+    case 'c':
+      num[0] = __builtin_va_arg(ap, int);
+      n = 1;
+      break;
+    case 's':
+      s = __builtin_va_arg(ap, char *);
+      if (s == NULL)
+	s = "(null)";
+      n = strlen(s);
+      break;
+    case '\0': /* 書式の末尾が % */
+      return len;
+    default: /* %% と，未対応の書式はそのまま出力する */
+      num[0] = *fmt;
+      n = 1;
+      break;
+    }
+
+    width -= n + neg;
+    if (neg && (pad == '0')) {
+      len = klog_emit(buf, len, '-');
+      neg = 0;
+    }
+    for (; width > 0; width--)
+      len = klog_emit(buf, len, pad);
+    if (neg)
+      len = klog_emit(buf, len, '-');
+    for (; n > 0; n--)
+      len = klog_emit(buf, len, *(s++));
+  }
+
+  return len;
+}
+
+/*
+ * 動作中のコアのバッファに書き込む．
+ * 同じコアの割込みハンドラとの排他のため割込み禁止で書き込むが，
+ * 他のコアや読み出し側とのロックは無いので待たされることは無い．
+ * メッセージは途中で切らずに，入りきらない場合は全体を捨てる．
+ */
+static int klog_put(const char *s, int len)
+{
+  klog_ring_t *ring;
+  uint32 cpsr, head;
+  int i;
+
+  INTR_SAVE(cpsr);
+  ring = &klog_rings[cpu_id()];
+  head = ring->head;
+  if (KLOG_BUF_SIZE - (head - ring->tail) < len + 1) {
+    ring->stat.dropped++;
+    INTR_RESTORE(cpsr);
+    return -1;
+  }
+  smp_mb(); /* tail を読んでから空き領域に書き込む */
+  ring->buf[head & (KLOG_BUF_SIZE - 1)] = len;
+  for (i = 0; i < len; i++)
+    ring->buf[(head + 1 + i) & (KLOG_BUF_SIZE - 1)] = s[i];
+  smp_mb(); /* データを書き込んでから head を更新する */
+  ring->head = head + 1 + len;
+  ring->stat.written++;
+  INTR_RESTORE(cpsr);
+
+  return len;
+}
+
+int klog_write(const void *p, int len)
+{
+  if ((len < 0) || (len > KLOG_RECORD_SIZE))
+    return -1;
+  if (!len)
+    return 0;
+
+  if (klog_put(p, len) < 0)
+    return -1;
+
+  if (klog_kick) /* 出力が止まっていれば開始させる */
+    klog_kick();
+
+  return len;
+}
+
+int kprintf(int level, const char *fmt, ...)
+{
+  char line[KLOG_LINE_SIZE];
+  __builtin_va_list ap;
+  int len;
+
+  if (level > klog_level)
+    return 0;
+
+  __builtin_va_start(ap, fmt);
+  len = klog_format(line, fmt, ap);
+  __builtin_va_end(ap);
+
+  return klog_write(line, len);
+}
+
+int klog_ratelimit(klog_ratelimit_t *rl)
+{
+  uint32 now, cpsr;
+  int missed;
+
+  now = timer_get();
+  if (now - rl->start >= KLOG_RATELIMIT_USEC) {
+    missed = rl->missed;
+    rl->start = now;
+    rl->count = 0;
+    rl->missed = 0;
+    if (missed)
+      kprintf(KLOG_WARN, "klog: %d messages suppressed\n", missed);
+  }
+
+  if (rl->count >= KLOG_RATELIMIT_BURST) {
+    rl->missed++;
+    INTR_SAVE(cpsr);
+    klog_rings[cpu_id()].stat.suppressed++;
+    INTR_RESTORE(cpsr);
+    return 0;
+  }
+  rl->count++;
+
+  return 1;
+}
+
+int klog_set_level(int level)
+{
+  int old = klog_level;
+  if ((level >= 0) && (level < KLOG_LEVEL_NUM))
+    klog_level = level;
+  return old;
+}
+
+int klog_get_stat(int cpu, klog_stat_t *stat)
+{
+  if ((cpu < 0) || (cpu >= KZ_CPU_NUM))
+    return -1;
+  memcpy(stat, &klog_rings[cpu].stat, sizeof(*stat));
+  return 0;
+}
+
+void klog_set_kick(void (*kick)(void))
+{
+  klog_kick = kick;
+}
+
+/* バッファから１バイト読み出す */
+static int klog_read(klog_ring_t *ring)
+{
+  int c;
+
+  smp_mb(); /* head を読んでからデータを読む */
+  c = (unsigned char)ring->buf[ring->tail & (KLOG_BUF_SIZE - 1)];
+  smp_mb(); /* データを読んでから tail を更新する */
+  ring->tail++;
+
+  return c;
+}
+
+/*
+ * レコードの途中では，他のコアのバッファに切り替えない．
+ * レコードは全体が書き込まれてから head が進むので，読み出し側が
+ * 書き込み途中のレコードを見ることは無い．
+ * レコードの区切りごとに，次のコアのバッファから順に探す．
+ */
+int klog_getc(void)
+{
+  klog_ring_t *ring;
+  int i;
+
+  if (!klog_remain) {
+    for (i = 0; i < KZ_CPU_NUM; i++) {
+      if (++klog_read_cpu == KZ_CPU_NUM)
+	klog_read_cpu = 0;
+      ring = &klog_rings[klog_read_cpu];
+      if (ring->tail != ring->head)
+	break;
+    }
+    if (i == KZ_CPU_NUM)
+      return -1;
+    klog_remain = klog_read(ring);
+  }
+
+  klog_remain--;
+  return klog_read(&klog_rings[klog_read_cpu]);
+}
+
+int klog_in_record(void)
+{
+  return klog_remain != 0;
+}
@@ -0,0 +1,74 @@
+#ifndef _KLOG_H_INCLUDED_
+#define _KLOG_H_INCLUDED_
+
+/*
+ * カーネルのログ．
+ * kprintf() はコアごとのリング・バッファに書式化して書き込むだけで，
+ * シリアルへの出力はコンソール・ドライバが送信割込みの延長で行う．
+ * 割込みハンドラやカーネルの内部からも呼び出せて，待たされることは無い．
+ * (バッファが一杯ならばメッセージを捨てて，捨てた数を数える)
+ */
+
+/* ログのレベル(数値が小さいほど重要) */
+#define KLOG_ERR       0
+#define KLOG_WARN      1
+#define KLOG_INFO      2
+#define KLOG_DEBUG     3
+#define KLOG_LEVEL_NUM 4
+
+/* １レコードの最大長(長さを1バイトで記録する) */
+#define KLOG_RECORD_SIZE 255
+
+/* ログの統計(コアごと) */
+typedef struct {
+  uint32 written;    /* 書き込んだメッセージの数 */
+  uint32 dropped;    /* バッファが一杯で捨てたメッセージの数 */
+  uint32 suppressed; /* 頻度制限で抑止したメッセージの数 */
+} klog_stat_t;
+
+/* 頻度制限の状態(呼び出し箇所ごとに静的に置く) */
+typedef struct {
+  uint32 start; /* 現在の期間の開始時刻 */
+  int count;    /* 期間内に出力した数 */
+  int missed;   /* 期間内に抑止した数 */
+} klog_ratelimit_t;
+
+/*
+ * 書式は %d %u %x %c %s %p %% で，フラグは 0 と幅のみ．
+ * (libgccを使わないので，10進の変換も割算を使わずに行う)
+ */
+int kprintf(int level, const char *fmt, ...);
+
+/*
+ * 頻度制限付きの kprintf()．割込み処理などの頻繁に通る箇所で使う．
+ * 呼び出し箇所ごとに，KLOG_RATELIMIT_USEC の期間に KLOG_RATELIMIT_BURST 個
+ * までを出力し，抑止した数は次の期間の最初にまとめて出力する．
+ */
+#define kprintf_ratelimited(level, ...) do { \
+  static klog_ratelimit_t _klog_rl; \
+  if (klog_ratelimit(&_klog_rl)) \
+    kprintf(level, __VA_ARGS__); \
+  } while (0)
+
+int klog_ratelimit(klog_ratelimit_t *rl); /* 出力してよいか */
+int klog_set_level(int level); /* 出力するレベルの設定(以前の値を返す) */
+int klog_get_stat(int cpu, klog_stat_t *stat); /* 統計の取得 */
+
+/*
+ * 書式化せずにそのまま書き込む(レベルによらず出力する)．
+ * テレメトリのフレームのように，途中に他の出力を挟めないデータに使う．
+ * 長さは KLOG_RECORD_SIZE まで．
+ */
+int klog_write(const void *p, int len);
+
+/*
+ * 出力側(コンソール・ドライバ)のためのインターフェース．
+ * klog_getc() はレコード(１回の書き込み)の途中で別のコアのバッファに
+ * 切り替えないので，複数のコアの出力が混ざることは無い．
+ * 読み出し側は排他して呼ぶこと．
+ */
+void klog_set_kick(void (*kick)(void)); /* 書き込み時に呼ぶ出力開始処理 */
+int klog_getc(void); /* １文字の読み出し(空ならば-1) */
+int klog_in_record(void); /* レコードの途中まで読み出しているか */
+
+#endif
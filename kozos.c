@@ -5,24 +5,89 @@
 #include "syscall.h"
 #include "memory.h"
 #include "lib.h"
-
-#define THREAD_NUM 6
-#define PRIORITY_NUM 16
-#define THREAD_NAME_SIZE 15
+#include "latency.h"
+#include "timer.h"
+#include "smp.h"
+#include "boot.h"
+#include "klog.h"
+#include "telemetry.h"
+
+/*
+ * テーブルの大きさは kozos_config.h で定義する．
+ * スレッドIDの下位8ビットにTCBのインデックスを入れるので，TCBは255個まで．
+ */
+KZ_STATIC_ASSERT(THREAD_NUM <= 255, "THREAD_NUM must be 255 or less");
+KZ_STATIC_ASSERT(PRIORITY_NUM <= 32, "readymap holds 32 priorities");
+KZ_STATIC_ASSERT(MSGBOX_NUM >= MSGBOX_ID_NUM,
+		 "MSGBOX_NUM must cover the static message boxes");
+KZ_STATIC_ASSERT(KZ_IS_POW2(DEFER_NUM), "DEFER_NUM must be a power of 2");
+
+#define IDLE_PRIORITY (PRIORITY_NUM - 1) /* アイドル・スレッドの優先度 */
+#define STACK_PAINT 0xa5       /* スタックの未使用部分を埋めるパターン */
+#define STACK_GUARD 0xdeadbeef /* スタックの最下位に置くガード・ワード */
+#define VFP_REGS_NUM 33        /* 退避するVFPレジスタ(d0-d15, fpscr) */
+#define VFP_FPEXC_EN (1 << 30) /* FPEXC: VFP有効 */
+#define VFP_FPSCR_INIT ((1 << 25) | (1 << 24)) /* FPSCR初期値: DN, FZ */
+
+/*
+ * EDFスケジューリング・クラスのスレッドが動作する優先度．
+ * この優先度の中では，デッドラインの早いスレッドから実行する．
+ * (コンソール・ドライバなど，より優先度の高いスレッドには割り込まれる)
+ */
+#define EDF_PRIORITY 2
+#define EDF_CPU      0
+KZ_STATIC_ASSERT(EDF_PRIORITY < PRIORITY_NUM - 1,
+		 "EDF_PRIORITY must be above the idle priority");
 
 /* スレッド・コンテキスト */
 typedef struct _kz_context {
   uint32 sp; /* スタック・ポインタ */
 } kz_context;
 
+// ARM版のスレッドコンテキスト(割込みの入口でスタックに保存される)
+// TODO: lkの実装を参考にいい感じにする
+typedef struct {
+  volatile uint32 sp;
+  volatile uint32 lr;
+  volatile uint32 spsr;
+  volatile uint32 r[13];
+  volatile uint32 pc;
+} kz_arm_context;
+
 /* タスク・コントロール・ブロック(TCB) */
 typedef struct _kz_thread {
   struct _kz_thread *next;
   char name[THREAD_NAME_SIZE + 1]; /* スレッド名 */
-  int priority;   /* 優先度 */
+  int priority;   /* 優先度(優先度継承による変更を含む) */
+  int base_priority; /* 本来の優先度 */
+  int msgpri;     /* 処理中のメッセージの優先度 */
+  struct _kz_thread **waitque; /* 接続されている待ちキュー */
+  struct _kz_mutex *wait_mutex; /* ロック待ちしているミューテックス */
+  struct _kz_thread *server; /* kz_call() のメッセージを受信したスレッド */
   uint32 *stack;    /* スタック */
+  int stacksize;  /* スタックのサイズ(サイズ・クラスに切り上げたもの) */
+  int cpu;        /* 動作するコア */
+  uint32 affinity; /* 動作可能なコアのビットマップ */
   uint32 flags;   /* 各種フラグ */
 #define KZ_THREAD_FLAG_READY (1 << 0)
+#define KZ_THREAD_FLAG_VFP   (1 << 1) /* VFPを使用したスレッド */
+#define KZ_THREAD_FLAG_CALL  (1 << 2) /* kz_call() の応答待ち */
+#define KZ_THREAD_FLAG_EDF   (1 << 3) /* EDFスケジューリング・クラス */
+#define KZ_THREAD_FLAG_EDFWAIT (1 << 4) /* 次の周期の開始待ち */
+#define KZ_THREAD_FLAG_RINGWAIT (1 << 5) /* リング・チャネルの空き/データ待ち */
+  uint32 generation; /* TCBが再利用された回数(スレッドIDの検証用) */
+
+  struct { /* EDFスケジューリングのパラメータ(単位はティック) */
+    uint32 period;   /* 周期 */
+    uint32 budget;   /* 周期ごとの実行時間の予算 */
+    uint32 deadline; /* 周期の開始からの相対デッドライン */
+    uint32 release;  /* 次の周期の開始時刻 */
+    uint32 abs_deadline; /* 現在のジョブの絶対デッドライン */
+    uint32 remaining; /* 現在の周期の予算の残り */
+    int heapidx;     /* デッドライン・ヒープ中の位置 */
+    uint32 misses;   /* デッドライン・ミスの回数 */
+    uint32 overruns; /* 予算超過の回数 */
+  } edf;
 
   struct { /* スレッドのスタート・アップ(thread_init())に渡すパラメータ */
     kz_func_t func; /* スレッドのメイン関数 */
@@ -36,51 +101,370 @@ typedef struct _kz_thread {
   } syscall;
 
   kz_context context; /* コンテキスト情報 */
+
+  uint32 vfpregs[VFP_REGS_NUM]; /* VFPレジスタの退避領域 */
 } kz_thread;
 
 /* メッセージ・バッファ */
 typedef struct _kz_msgbuf {
   struct _kz_msgbuf *next;
-  kz_thread *sender; /* メッセージを送信したスレッド */
+  kz_thread_id_t sender; /* メッセージを送信したスレッド */
+  int priority;      /* メッセージの優先度 */
+  uint32 flags;
+#define KZ_MSGBUF_FLAG_CALL (1 << 0) /* kz_call() で送信したメッセージ */
   struct { /* メッセージのパラメータ保存領域 char*/
     int size;
     char *p;
   } param;
 } kz_msgbuf;
 
-/* メッセージ・ボックス */
-typedef struct _kz_msgbox {
-  kz_thread *receiver; /* 受信待ち状態のスレッド */
+/*
+ * メッセージ・ボックス
+ * H8は16ビットCPUなので，32ビット整数に対しての乗算命令が無い．よって
+ * 構造体のサイズが２の累乗になっていないと，構造体の配列のインデックス
+ * 計算で乗算が使われて「___mulsi3が無い」などのリンク・エラーになる場合が
+ * ある．(２の累乗ならばシフト演算が利用されるので問題は出ない)
+ * 対策として，KZ_POW2_STRUCT() でサイズを２の累乗に切り上げる．
+ * 他構造体で同様のエラーが出た場合には，同様の対処をすること．
+ */
+typedef KZ_POW2_STRUCT(
+  kz_thread *receiver; /* 受信待ち状態のスレッドのキュー(優先度順) */
   kz_msgbuf *head;
   kz_msgbuf *tail;
+  uint32 flags;        /* 各種フラグ */
+  kz_thread *owner;    /* 最後に受信したスレッド(優先度継承の対象) */
+) kz_msgbox;
+
+#define KZ_MSGBOX_FLAG_USED     (1 << 0)
+#define KZ_MSGBOX_FLAG_PRIORITY (1 << 1) /* 優先度順の配送と優先度継承 */
+
+/*
+ * リング・チャネル
+ * 生成時に固定サイズのスロットをまとめて獲得しておき，スロットの領域を
+ * そのままスレッド間で受け渡す．送受信ごとの動的メモリの獲得/解放や
+ * データのコピーが不要になる．
+ * プロデューサ/コンシューマはそれぞれ１スレッドを想定している．
+ */
+typedef struct _kz_ring {
+  int slotsize;        /* スロットのサイズ */
+  int slotnum;         /* スロットの個数 */
+  char *buffer;        /* スロット領域 */
+  int head;            /* 読み出し位置 */
+  int tail;            /* 書き込み位置 */
+  int count;           /* コミット済みのスロット数 */
+  kz_thread *producer; /* 空きスロット待ち状態のスレッド */
+  kz_thread *consumer; /* データ待ち状態のスレッド */
+} kz_ring;
+
+/* セマフォ(計数型) */
+typedef struct _kz_sem {
+  uint32 flags;       /* 各種フラグ */
+#define KZ_SEM_FLAG_USED (1 << 0)
+  int count;          /* 資源の残り数 */
+  kz_thread *waiter;  /* 獲得待ち状態のスレッドのキュー(優先度順) */
+} kz_sem;
+
+/* ミューテックス(優先度継承つき) */
+typedef struct _kz_mutex {
+  uint32 flags;       /* 各種フラグ */
+#define KZ_MUTEX_FLAG_USED (1 << 0)
+  kz_thread *owner;   /* ロックを保持しているスレッド */
+  kz_thread *waiter;  /* ロック待ち状態のスレッドのキュー(優先度順) */
+} kz_mutex;
+
+/* イベントフラグ */
+typedef struct _kz_flag {
+  uint32 flags;       /* 各種フラグ */
+#define KZ_FLAG_FLAG_USED (1 << 0)
+  uint32 pattern;     /* 現在のビット・パターン */
+  kz_thread *waiter;  /* 待ち状態のスレッドのキュー(優先度順) */
+} kz_flag;
+
+/*
+ * コアごとの状態．
+ * スレッドはアフィニティで許されたコアのレディー・キューに繋がれる．
+ * 自コアのキューに動作可能なスレッドが無くなると，許されたスレッドを
+ * 他のコアから移動してくる(steal())．
+ */
+typedef struct _kz_cpu {
+  /* スレッドのレディー・キュー */
+  struct {
+    kz_thread *head;
+    kz_thread *tail;
+  } readyque[PRIORITY_NUM];
+
+  /*
+   * レディー・キューが空でない優先度のビットマップ．
+   * (ビットiが readyque[i] に対応する．スケジューリング時の検索に使う)
+   */
+  uint32 readymap;
+
+  kz_thread *current; /* カレント・スレッド */
+  kz_thread *vfp_owner; /* VFPレジスタの内容を保持しているスレッド */
+  int nready;    /* レディー・キューに接続されているスレッドの数 */
+  int intr_nest; /* 割込みのネスト段数 */
+  uint32 intr_start; /* 最も外側のIRQの発生時刻 */
+  kz_thread *intr_thread; /* 最も外側の割込みで割り込まれたスレッド */
 
   /*
-   * H8は16ビットCPUなので，32ビット整数に対しての乗算命令が無い．よって
-   * 構造体のサイズが２の累乗になっていないと，構造体の配列のインデックス
-   * 計算で乗算が使われて「___mulsi3が無い」などのリンク・エラーになる場合が
-   * ある．(２の累乗ならばシフト演算が利用されるので問題は出ない)
-   * 対策として，サイズが２の累乗になるようにダミー・メンバで調整する．
-   * 他構造体で同様のエラーが出た場合には，同様の対処をすること．
+   * 割込みハンドラから登録された遅延処理のキュー．
+   * 最も外側の割込みの終了時に，割込み許可で実行される．
    */
-  long dummy[1];
-} kz_msgbox;
+  struct {
+    kz_defer_t func;
+    void *arg;
+  } defers[DEFER_NUM];
+  unsigned int defer_head; /* 次に実行する位置 */
+  unsigned int defer_tail; /* 次に登録する位置 */
+} kz_cpu;
+
+static kz_cpu cpus[KZ_CPU_NUM];
+
+#if KZ_CPU_NUM > 1
+/*
+ * 他のコアで使用中のスレッドか？
+ * (以下のマクロ定義の後ではメンバ名が置換されるので，ここで定義する)
+ */
+static int cpu_is_busy(kz_cpu *cpu, kz_thread *thp)
+{
+  return (thp == cpu->current) || (thp == cpu->intr_thread) ||
+    (thp == cpu->vfp_owner);
+}
 
-/* スレッドのレディー・キュー */
-static struct {
-  kz_thread *head;
-  kz_thread *tail;
-} readyque[PRIORITY_NUM];
+/* コアで動作中のスレッド(割込みの処理中ならば，割り込まれたスレッド) */
+static kz_thread *cpu_running(kz_cpu *cpu)
+{
+  return cpu->current ? cpu->current : cpu->intr_thread;
+}
+#endif
+
+/*
+ * 動作中のコアの状態．(シングル・コアの場合は定数アドレスになる)
+ * 以下のコアごとの変数は，動作中のコアのものを参照する．
+ */
+#define CPU         (&cpus[cpu_id()])
+#define current     (CPU->current)
+#define vfp_owner   (CPU->vfp_owner)
+#define intr_nest   (CPU->intr_nest)
+#define intr_start  (CPU->intr_start)
+#define intr_thread (CPU->intr_thread)
+#define defers      (CPU->defers)
+#define defer_head  (CPU->defer_head)
+#define defer_tail  (CPU->defer_tail)
+
+/*
+ * カーネル・ロック．
+ * スレッドやカーネル・オブジェクトはすべてのコアで共有しているので，
+ * カーネル内の処理はこのロックを獲得して行う．
+ * 割込み処理の入口で獲得し，dispatch() でスレッドのスタックを切り替えた後に
+ * 解放される．(アセンブラから参照するので static にしない)
+ */
+kz_spinlock_t kernel_lock;
 
-static kz_thread *current; /* カレント・スレッド */
 static kz_thread threads[THREAD_NUM]; /* タスク・コントロール・ブロック */
+static kz_thread *freethreads; /* 未使用のTCBのリスト */
 static kz_handler_t handlers[SOFTVEC_TYPE_NUM]; /* 割込みハンドラ */
-static kz_msgbox msgboxes[MSGBOX_ID_NUM]; /* メッセージ・ボックス */
+static kz_msgbox msgboxes[MSGBOX_NUM]; /* メッセージ・ボックス */
+static kz_ring rings[RING_NUM]; /* リング・チャネル */
+static kz_thread *selectors; /* kz_select() で待ち状態のスレッド */
+static kz_sem sems[SEM_NUM]; /* セマフォ */
+static kz_mutex mutexes[MUTEX_NUM]; /* ミューテックス */
+static kz_flag eventflags[FLAG_NUM]; /* イベントフラグ */
+
+static uint32 ticks; /* ティック・カウンタ */
+
+/*
+ * EDFスケジューリング・クラスの動作可能なスレッド．
+ * 絶対デッドラインの早い順のヒープ(二分木)で管理する．
+ * (ティック割込みを受けるコア EDF_CPU でのみ動作させる)
+ */
+static kz_thread *edfheap[THREAD_NUM];
+static int edfheap_num;
+static kz_thread *edfsleepers; /* 次の周期の開始待ち(開始時刻順) */
 
 void dispatch(kz_context *context);
+void vfp_save(uint32 *regs);
+void vfp_restore(uint32 *regs);
+uint32 vfp_get_fpexc(void);
+void vfp_set_fpexc(uint32 fpexc);
 static void thread_intr(softvec_type_t type, unsigned long sp);
 
+/* EDFスケジューリング・クラスとしてキューイングされるスレッドか？ */
+#define THREAD_IS_EDF(thp) \
+  (((thp)->flags & KZ_THREAD_FLAG_EDF) && ((thp)->priority == EDF_PRIORITY))
+
+/* ティック値の比較(オーバーフローを考慮する) */
+#define TICK_BEFORE(a, b) ((long)((a) - (b)) < 0)
+
+static void edfheap_set(int i, kz_thread *thp)
+{
+  edfheap[i] = thp;
+  thp->edf.heapidx = i;
+}
+
+/* ヒープの要素を親の方向に移動する */
+static void edfheap_up(int i)
+{
+  kz_thread *thp = edfheap[i];
+  int parent;
+
+  while (i > 0) {
+    parent = (i - 1) >> 1;
+    if (!TICK_BEFORE(thp->edf.abs_deadline,
+		     edfheap[parent]->edf.abs_deadline))
+      break;
+    edfheap_set(i, edfheap[parent]);
+    i = parent;
+  }
+  edfheap_set(i, thp);
+}
+
+/* ヒープの要素を子の方向に移動する */
+static void edfheap_down(int i)
+{
+  kz_thread *thp = edfheap[i];
+  int child;
+
+  while ((child = (i << 1) + 1) < edfheap_num) {
+    if ((child + 1 < edfheap_num) &&
+	TICK_BEFORE(edfheap[child + 1]->edf.abs_deadline,
+		    edfheap[child]->edf.abs_deadline))
+      child++;
+    if (!TICK_BEFORE(edfheap[child]->edf.abs_deadline,
+		     thp->edf.abs_deadline))
+      break;
+    edfheap_set(i, edfheap[child]);
+    i = child;
+  }
+  edfheap_set(i, thp);
+}
+
+static void edfheap_insert(kz_thread *thp)
+{
+  edfheap_set(edfheap_num++, thp);
+  edfheap_up(edfheap_num - 1);
+}
+
+static void edfheap_delete(kz_thread *thp)
+{
+  int i = thp->edf.heapidx;
+
+  edfheap_num--;
+  if (i < edfheap_num) {
+    edfheap_set(i, edfheap[edfheap_num]);
+    edfheap_up(i);
+    edfheap_down(edfheap[i]->edf.heapidx);
+  }
+}
+
+/* 優先度 priority のスレッドの有無をビットマップに反映する */
+static KZ_HOT void readymap_update(kz_cpu *cpu, int priority)
+{
+  if (cpu->readyque[priority].head ||
+      ((priority == EDF_PRIORITY) && (cpu == &cpus[EDF_CPU]) && edfheap_num))
+    cpu->readymap |= (uint32)1 << priority;
+  else
+    cpu->readymap &= ~((uint32)1 << priority);
+}
+
+/*
+ * 他のコアのレディー・キューに接続したならば，そのコアに再スケジューリングを
+ * 要求する．動作中のスレッドを横取りしない場合は要求しない．
+ * (割込みはカーネル処理の終了時に，宛先ごとにまとめて送られる)
+ */
+static void readyque_notify(kz_thread *thp)
+{
+#if KZ_CPU_NUM > 1
+  kz_thread *run;
+
+  if (thp->cpu == cpu_id())
+    return;
+  run = cpu_running(&cpus[thp->cpu]);
+  if (!run || (thp->priority < run->priority) || THREAD_IS_EDF(thp))
+    ipi_request(thp->cpu, IPI_RESCHEDULE);
+#endif
+}
+
+/*
+ * スレッドをレディー・キューの末尾に接続する．
+ * (レディー・キューは，スレッドが動作するコアのものを使う)
+ */
+static KZ_HOT void readyque_append(kz_thread *thp)
+{
+  kz_cpu *cpu = &cpus[thp->cpu];
+
+  cpu->nready++;
+  readyque_notify(thp);
+
+  if (THREAD_IS_EDF(thp)) { /* EDFのスレッドはデッドライン順に並べる */
+    edfheap_insert(thp);
+    cpu->readymap |= (uint32)1 << thp->priority;
+    thp->flags |= KZ_THREAD_FLAG_READY;
+    return;
+  }
+
+  if (cpu->readyque[thp->priority].tail) {
+    cpu->readyque[thp->priority].tail->next = thp;
+  } else {
+    cpu->readyque[thp->priority].head = thp;
+  }
+  cpu->readyque[thp->priority].tail = thp;
+  cpu->readymap |= (uint32)1 << thp->priority;
+  thp->flags |= KZ_THREAD_FLAG_READY;
+}
+
+/*
+ * スレッドをレディー・キューの先頭に接続する．
+ * (同じ優先度の他のスレッドより先に動作させる．kz_call()/kz_reply() で
+ * 実行権を相手のスレッドに直接引き渡すために使う)
+ */
+static KZ_HOT void readyque_prepend(kz_thread *thp)
+{
+  kz_cpu *cpu = &cpus[thp->cpu];
+
+  if (THREAD_IS_EDF(thp)) { /* EDFのスレッドはデッドライン順のまま */
+    readyque_append(thp);
+    return;
+  }
+
+  cpu->nready++;
+  readyque_notify(thp);
+  thp->next = cpu->readyque[thp->priority].head;
+  cpu->readyque[thp->priority].head = thp;
+  if (cpu->readyque[thp->priority].tail == NULL)
+    cpu->readyque[thp->priority].tail = thp;
+  cpu->readymap |= (uint32)1 << thp->priority;
+  thp->flags |= KZ_THREAD_FLAG_READY;
+}
+
+/* スレッドをレディー・キューから抜き出す(先頭以外にあってもよい) */
+static KZ_HOT void readyque_remove(kz_thread *thp)
+{
+  kz_cpu *cpu = &cpus[thp->cpu];
+  kz_thread **thpp, *prev = NULL;
+
+  cpu->nready--;
+  if (THREAD_IS_EDF(thp)) {
+    edfheap_delete(thp);
+  } else {
+    for (thpp = &cpu->readyque[thp->priority].head; *thpp;
+	 thpp = &(*thpp)->next) {
+      if (*thpp == thp) {
+	*thpp = thp->next;
+	if (cpu->readyque[thp->priority].tail == thp)
+	  cpu->readyque[thp->priority].tail = prev;
+	break;
+      }
+      prev = *thpp;
+    }
+  }
+  readymap_update(cpu, thp->priority);
+  thp->flags &= ~KZ_THREAD_FLAG_READY;
+  thp->next = NULL;
+}
+
 /* カレント・スレッドをレディー・キューから抜き出す */
-static int getcurrent(void)
+static KZ_HOT int getcurrent(void)
 {
   if (current == NULL) {
     return -1;
@@ -90,10 +474,19 @@ static int getcurrent(void)
     return 1;
   }
 
-  /* カレント・スレッドは必ず先頭にあるはずなので，先頭から抜き出す */
-  readyque[current->priority].head = current->next;
-  if (readyque[current->priority].head == NULL) {
-    readyque[current->priority].tail = NULL;
+  /*
+   * カレント・スレッドは必ず先頭にあるはずなので，先頭から抜き出す．
+   * (EDFのスレッドの場合は，デッドライン・ヒープの先頭にある)
+   */
+  if (THREAD_IS_EDF(current)) {
+    readyque_remove(current);
+    return 0;
+  }
+  CPU->nready--;
+  CPU->readyque[current->priority].head = current->next;
+  if (CPU->readyque[current->priority].head == NULL) {
+    CPU->readyque[current->priority].tail = NULL;
+    readymap_update(CPU, current->priority);
   }
   current->flags &= ~KZ_THREAD_FLAG_READY;
   current->next = NULL;
@@ -102,7 +495,7 @@ static int getcurrent(void)
 }
 
 /* カレント・スレッドをレディー・キューに繋げる */
-static int putcurrent(void)
+static KZ_HOT int putcurrent(void)
 {
   if (current == NULL) {
     return -1;
@@ -113,17 +506,158 @@ static int putcurrent(void)
   }
 
   /* レディー・キューの末尾に接続する */
-  if (readyque[current->priority].tail) {
-    readyque[current->priority].tail->next = current;
+  readyque_append(current);
+
+  return 0;
+}
+
+/*
+ * 待ちキューにスレッドを接続する．
+ * 優先度の高い順に並べ，同じ優先度の中では到着順(FIFO)とする．
+ */
+static void waitque_insert(kz_thread **quep, kz_thread *thp)
+{
+  kz_thread **head = quep;
+
+  while (*quep && ((*quep)->priority <= thp->priority))
+    quep = &(*quep)->next;
+  thp->next = *quep;
+  *quep = thp;
+  thp->waitque = head;
+}
+
+/* 待ちキューからスレッドを外す */
+static void waitque_remove(kz_thread *thp)
+{
+  kz_thread **quep;
+
+  for (quep = thp->waitque; *quep; quep = &(*quep)->next) {
+    if (*quep == thp) {
+      *quep = thp->next;
+      break;
+    }
+  }
+  thp->next = NULL;
+  thp->waitque = NULL;
+}
+
+/* 待ちキューの先頭のスレッドを抜き出す */
+static kz_thread *waitque_pop(kz_thread **quep)
+{
+  kz_thread *thp = *quep;
+  if (thp) {
+    *quep = thp->next;
+    thp->next = NULL;
+    thp->waitque = NULL;
+  }
+  return thp;
+}
+
+/*
+ * スレッドの優先度を変更する．
+ * レディー・キューや待ちキューに接続されている場合は，新しい優先度の
+ * 位置に繋ぎ直す．
+ */
+static void thread_setpri(kz_thread *thp, int priority)
+{
+  kz_thread **quep;
+
+  if (thp->priority == priority)
+    return;
+
+  if (thp->flags & KZ_THREAD_FLAG_READY) {
+    readyque_remove(thp);
+    thp->priority = priority;
+    readyque_append(thp);
+  } else if (thp->waitque) {
+    quep = thp->waitque;
+    waitque_remove(thp);
+    thp->priority = priority;
+    waitque_insert(quep, thp);
   } else {
-    readyque[current->priority].head = current;
+    thp->priority = priority;
   }
-  readyque[current->priority].tail = current;
-  current->flags |= KZ_THREAD_FLAG_READY;
+}
 
-  return 0;
+static int msgbox_inherited_priority(kz_thread *thp);
+
+/*
+ * 保持しているミューテックスのロック待ちスレッドのうち，最も高い優先度を
+ * 返す．(待ちキューは優先度順なので，先頭だけを見ればよい)
+ */
+static int mutex_inherited_priority(kz_thread *thp)
+{
+  int i, priority = PRIORITY_NUM;
+  kz_mutex *mutexp;
+
+  for (i = 0; i < MUTEX_NUM; i++) {
+    mutexp = &mutexes[i];
+    if ((mutexp->owner == thp) && mutexp->waiter &&
+	(mutexp->waiter->priority < priority))
+      priority = mutexp->waiter->priority;
+  }
+
+  return priority;
+}
+
+/*
+ * スレッドの実効優先度を再計算する．
+ * 本来の優先度と，優先度継承により引き継いだ優先度のうち高い方にする．
+ */
+static void thread_update_priority(kz_thread *thp)
+{
+  int priority = thp->base_priority;
+  int inherited;
+
+  inherited = msgbox_inherited_priority(thp);
+  if (inherited < priority)
+    priority = inherited;
+  inherited = mutex_inherited_priority(thp);
+  if (inherited < priority)
+    priority = inherited;
+
+  if (thp->priority == priority)
+    return;
+  thread_setpri(thp, priority);
+
+  /*
+   * 別のミューテックスのロック待ちをしている場合は，そのミューテックスを
+   * 保持しているスレッドにも優先度を継承させる．(継承の連鎖)
+   */
+  if (thp->wait_mutex && thp->wait_mutex->owner)
+    thread_update_priority(thp->wait_mutex->owner);
+}
+
+/*
+ * スレッドID．
+ * 下位8ビットがTCBのインデックス+1，その上の23ビットがTCBの世代番号．
+ * 終了したスレッドのIDは，TCBが再利用されても別のスレッドを指さない．
+ * (最上位ビットは常に0なので，エラーを示す-1と重なることは無い)
+ */
+#define THREAD_GENERATION_MASK 0x7fffff
+#define THREAD_ID(thp) \
+  ((kz_thread_id_t)(((thp)->generation << 8) | ((thp) - threads + 1)))
+
+/* スレッドIDからTCBを得る(無効なIDならばNULLを返す) */
+static kz_thread *thread_lookup(kz_thread_id_t id)
+{
+  int index = (int)(id & 0xff) - 1;
+  kz_thread *thp;
+
+  if ((index < 0) || (index >= THREAD_NUM))
+    return NULL;
+  thp = &threads[index];
+  if (!thp->init.func || (THREAD_ID(thp) != id))
+    return NULL;
+
+  return thp;
 }
 
+static void select_wakeup(void);
+static void select_abort(kz_msgbox_id_t id);
+static void mutex_handoff(kz_mutex *mutexp);
+static void call_abort(kz_thread *server);
+
 static void thread_end(void)
 {
   kz_exit();
@@ -141,59 +675,95 @@ static int thread_exit(void);
 
 /* システム・コールの処理(kz_run():スレッドの起動) */
 static kz_thread_id_t thread_run(kz_func_t func, char *name, int priority,
-				 int stacksize, int argc, char *argv[])
+				 int stacksize, int argc, char *argv[],
+				 uint32 affinity)
 {
-  int i;
   kz_thread *thp;
-  uint32 *sp;
-  extern char _userstack; /* リンカ・スクリプトで定義されるスタック領域 */
-  static char *thread_stack = &_userstack;
+  char *stack;
+  uint32 generation;
+  int cpu;
+
+  /* 動作可能なコアが無い */
+  affinity &= ((uint32)1 << KZ_CPU_NUM) - 1;
+  if (!affinity) {
+    putcurrent();
+    return -1;
+  }
 
-  /* 空いているタスク・コントロール・ブロックを検索 */
-  for (i = 0; i < THREAD_NUM; i++) {
-    thp = &threads[i];
-    if (!thp->init.func) /* 見つかった */
-      break;
+  /* 未使用のタスク・コントロール・ブロックをリストから取得 */
+  thp = freethreads;
+  if (thp == NULL) { /* 見つからなかった */
+    putcurrent();
+    return -1;
   }
-  if (i == THREAD_NUM) /* 見つからなかった */
+  freethreads = thp->next;
+
+  /* スタック領域をスタック・プールから獲得(獲得できなければ起動しない) */
+  stack = kzmem_stack_alloc(&stacksize);
+  if (stack == NULL) {
+    thp->next = freethreads; /* TCBは未使用リストに戻す */
+    freethreads = thp;
+    putcurrent();
     return -1;
+  }
+
+  /*
+   * 作成したコアで動作させる．作成したコアで動作できない場合は，
+   * 動作可能なコアのうち番号の最も小さいものにする．
+   */
+  cpu = cpu_id();
+  if (!(affinity & ((uint32)1 << cpu)))
+    cpu = __builtin_ctz(affinity);
 
+  generation = thp->generation; /* 世代番号は引き継ぐ */
   memset(thp, 0, sizeof(*thp));
+  thp->generation = generation;
 
   /* タスク・コントロール・ブロック(TCB)の設定 */
   strcpy(thp->name, name);
   thp->next     = NULL;
   thp->priority = priority;
+  thp->base_priority = priority;
+  thp->msgpri   = PRIORITY_NUM;
+  thp->cpu      = cpu;
+  thp->affinity = affinity;
   thp->flags    = 0;
 
   thp->init.func = func;
   thp->init.argc = argc;
   thp->init.argv = argv;
 
-  /* スタック領域を獲得 */
-  memset(thread_stack, 0, stacksize);
-  thread_stack += stacksize;
+  /*
+   * VFPレジスタは最初にVFP命令を実行した時点で読み込まれる．
+   * 非正規化数でサポート・コードへのトラップが発生しないように，
+   * FPSCRはフラッシュ・トゥ・ゼロ/デフォルトNaNのモードにしておく．
+   */
+  thp->vfpregs[VFP_REGS_NUM - 1] = VFP_FPSCR_INIT;
 
-  thp->stack = thread_stack; /* スタックを設定 */
+  /*
+   * 獲得したスタック領域は，使用量の計測のためにパターンで埋めておき，
+   * あふれの検出のために最下位にガード・ワードを置く．
+   * (MMUを使うようになったら，スタック間に未マップのガード・ページを
+   * 挟んでアクセス時点で検出できるようにすること)
+   */
+  memset(stack, STACK_PAINT, stacksize);
+  *(uint32 *)stack = STACK_GUARD;
 
+  thp->stack = (uint32 *)(stack + stacksize); /* スタックを設定 */
+  thp->stacksize = stacksize;
 
-  // ARM版のスレッドコンテキスト
-  // TODO: lkの実装を参考にいい感じにする
-  typedef struct {
-    volatile uint32 sp;
-    volatile uint32 lr;
-    volatile uint32 spsr;
-    volatile uint32 r[13];
-    volatile uint32 pc;
-  } kz_arm_context;
   /* スタックの初期化 */
   // TODO: RasPi対応スタック形式にする
   // sp = (uint32 *)thp->stack;
   // *(--sp) = (uint32)thread_end;
-  kz_arm_context *thc = (kz_arm_context *)((thp->stack - sizeof(kz_arm_context)));
-  
+  /*
+   * 初期コンテキストはスタックの底に置く．(スタックは再利用されるので，
+   * 獲得した領域からはみ出さないようにすること)
+   */
+  kz_arm_context *thc = (kz_arm_context *)thp->stack - 1;
+
   thc->lr = (volatile uint32)thread_end;
-  thc->sp = thp->stack;
+  thc->sp = (volatile uint32)thp->stack;
   thc->spsr = 0x0000001f;
 
   for (int i = 0; i < 13; i++) {
@@ -205,6 +775,10 @@ static kz_thread_id_t thread_run(kz_func_t func, char *name, int priority,
    * スレッドの優先度がゼロの場合には，割込み禁止スレッドとする．
    */
   thc->pc = (volatile uint32)thread_init;
+  if (thc->pc & 1) { /* Thumb命令でコンパイルされていれば，Thumbステートで開始 */
+    thc->pc &= ~1;
+    thc->spsr |= 0x20;
+  }
 
   /* スレッドのスタート・アップ(thread_init())に渡す引数 */
   thc->r[0] = (volatile uint32)thp;
@@ -219,19 +793,65 @@ static kz_thread_id_t thread_run(kz_func_t func, char *name, int priority,
   current = thp;
   putcurrent();
 
-  return (kz_thread_id_t)current;
+  return THREAD_ID(current);
 }
 
 /* システム・コールの処理(kz_exit():スレッドの終了) */
 static int thread_exit(void)
 {
   /*
-   * 本来ならスタックも解放して再利用できるようにすべきだが省略．
-   * このため，スレッドを頻繁に生成・消去するようなことは現状でできない．
+   * 終了のメッセージは書式化せずに klog_write() で書き込む．
+   * (kprintf() は終了するスレッドの小さなスタックには収まらないので使わない．
+   * カーネル・ロックの保持中なので，バッファは静的に置いてよい)
+   */
+  static const char suffix[] = " EXIT.\r\n";
+  static char exitmsg[THREAD_NAME_SIZE + sizeof(suffix)];
+  int i, len;
+  uint32 generation;
+
+  len = strlen(current->name);
+  memcpy(exitmsg, current->name, len);
+  memcpy(exitmsg + len, suffix, sizeof(suffix) - 1);
+  klog_write(exitmsg, len + sizeof(suffix) - 1);
+
+  /* 優先度継承の対象から外す */
+  for (i = 0; i < MSGBOX_NUM; i++) {
+    if (msgboxes[i].owner == current)
+      msgboxes[i].owner = NULL;
+  }
+
+  /* VFPレジスタの内容は不要になる */
+  if (vfp_owner == current)
+    vfp_owner = NULL;
+
+  /* 保持したままのミューテックスは，ロック待ちスレッドに引き渡す */
+  for (i = 0; i < MUTEX_NUM; i++) {
+    if (mutexes[i].owner == current)
+      mutex_handoff(&mutexes[i]);
+  }
+
+  /* 応答していない kz_call() の呼び出し元は，エラーで起こす */
+  call_abort(current);
+
+  /*
+   * スタックをスタック・プールに戻す．
+   * この処理自体は終了するスレッドのスタック上で動作しているが，
+   * 解放したスタックが再利用されるのは次にディスパッチされた
+   * スレッドが kz_run() を呼んだときなので問題は無い．
    */
-  puts(current->name);
-  puts(" EXIT.\n");
+  kzmem_stack_free((char *)current->stack - current->stacksize,
+		   current->stacksize);
+
+  /*
+   * TCBを未使用リストに戻す．世代番号を進めておくことで，
+   * 終了したスレッドのIDは以降無効になる．
+   */
+  generation = current->generation + 1;
   memset(current, 0, sizeof(*current));
+  current->generation = generation & THREAD_GENERATION_MASK;
+  current->next = freethreads;
+  freethreads = current;
+
   return 0;
 }
 
@@ -251,11 +871,19 @@ static int thread_sleep(void)
 /* システム・コールの処理(kz_wakeup():スレッドのウェイク・アップ) */
 static int thread_wakeup(kz_thread_id_t id)
 {
+  kz_thread *thp = thread_lookup(id);
+
   /* ウェイク・アップを呼び出したスレッドをレディー・キューに戻す */
   putcurrent();
 
+  /* 無効なIDや，kz_sleep()以外の要因で待ち状態のスレッドは対象外 */
+  if ((thp == NULL) || thp->waitque ||
+      (thp->flags & (KZ_THREAD_FLAG_CALL | KZ_THREAD_FLAG_EDFWAIT |
+		     KZ_THREAD_FLAG_RINGWAIT)))
+    return -1;
+
   /* 指定されたスレッドをレディー・キューに接続してウェイク・アップする */
-  current = (kz_thread *)id;
+  current = thp;
   putcurrent();
 
   return 0;
@@ -265,19 +893,178 @@ static int thread_wakeup(kz_thread_id_t id)
 static kz_thread_id_t thread_getid(void)
 {
   putcurrent();
-  return (kz_thread_id_t)current;
+  return THREAD_ID(current);
 }
 
 /* システム・コールの処理(kz_chpri():スレッドの優先度変更) */
 static int thread_chpri(int priority)
 {
-  int old = current->priority;
-  if (priority >= 0)
-    current->priority = priority; /* 優先度変更 */
+  int old = current->base_priority;
+  if (priority >= 0) {
+    current->flags &= ~KZ_THREAD_FLAG_EDF; /* 固定優先度に戻る */
+    current->base_priority = priority; /* 優先度変更 */
+    thread_update_priority(current);   /* 継承している優先度も考慮する */
+  }
   putcurrent(); /* 新しい優先度のレディー・キューに繋ぎ直す */
   return old;
 }
 
+/*
+ * システム・コールの処理(kz_ipi():他のコアへの処理の要求)
+ * cpumask のビットマップで指定したコアに，プロセッサ間割込みで reasons の
+ * 処理を要求する．割込みはシステム・コールの終了時にまとめて送られる．
+ */
+static int thread_ipi(uint32 cpumask, uint32 reasons)
+{
+  int i;
+
+  putcurrent();
+
+  for (i = 0; i < KZ_CPU_NUM; i++) {
+    if (cpumask & ((uint32)1 << i))
+      ipi_request(i, reasons);
+  }
+
+  return 0;
+}
+
+/*
+ * カレント・スレッドのVFPレジスタが動作中のコアに残っていれば退避する．
+ * (スレッドを別のコアに移動する前に呼ぶ．カレント・スレッドがVFPを
+ * 所有していれば，VFPは有効になっている)
+ */
+static void vfp_flush(kz_thread *thp)
+{
+  if (vfp_owner == thp) {
+    vfp_save(thp->vfpregs);
+    vfp_owner = NULL;
+  }
+}
+
+/*
+ * EDFのスレッドの次の周期を開始する．
+ * 予算を補充してデッドラインを設定し，レディー・キューに接続する．
+ */
+static void edf_release(kz_thread *thp)
+{
+  /* 開始時刻を過ぎていれば，現在時刻から周期を始め直す */
+  if (TICK_BEFORE(thp->edf.release, ticks))
+    thp->edf.release = ticks;
+  thp->edf.abs_deadline = thp->edf.release + thp->edf.deadline;
+  thp->edf.release += thp->edf.period;
+  thp->edf.remaining = thp->edf.budget;
+  readyque_append(thp);
+}
+
+/* EDFのスレッドを次の周期の開始待ちにする */
+static void edf_sleep(kz_thread *thp)
+{
+  kz_thread **thpp;
+
+  for (thpp = &edfsleepers; *thpp; thpp = &(*thpp)->next) {
+    if (TICK_BEFORE(thp->edf.release, (*thpp)->edf.release))
+      break;
+  }
+  thp->next = *thpp;
+  *thpp = thp;
+  thp->flags |= KZ_THREAD_FLAG_EDFWAIT;
+}
+
+/*
+ * システム・コールの処理(kz_edf():EDFスケジューリング・クラスへの移行)
+ * 周期，予算，相対デッドラインはティック単位で，予算 <= デッドライン <= 周期
+ * であること．呼び出した時点から最初の周期を開始する．
+ */
+static int thread_edf(uint32 period, uint32 budget, uint32 deadline)
+{
+  if (!budget || (budget > deadline) || (deadline > period)) {
+    putcurrent();
+    return -1;
+  }
+
+  current->edf.period   = period;
+  current->edf.budget   = budget;
+  current->edf.deadline = deadline;
+  current->edf.release  = ticks;
+  current->flags |= KZ_THREAD_FLAG_EDF;
+
+  /* ティック割込みを受けるコアに移動し，他のコアには移動させない */
+  if (current->cpu != EDF_CPU) {
+    vfp_flush(current);
+    current->cpu = EDF_CPU;
+  }
+  current->affinity = (uint32)1 << EDF_CPU;
+  current->base_priority = EDF_PRIORITY;
+  thread_update_priority(current);
+
+  edf_release(current);
+  return 0;
+}
+
+/*
+ * システム・コールの処理(kz_edf_wait():現在の周期の処理の終了)
+ * 次の周期の開始までスリープする．デッドラインを過ぎていればミスとして数える．
+ */
+static int thread_edf_wait(void)
+{
+  if (!(current->flags & KZ_THREAD_FLAG_EDF)) {
+    putcurrent();
+    return -1;
+  }
+
+  if (TICK_BEFORE(current->edf.abs_deadline, ticks))
+    current->edf.misses++;
+
+  if (TICK_BEFORE(ticks, current->edf.release))
+    edf_sleep(current);
+  else
+    edf_release(current);
+
+  return 0;
+}
+
+/*
+ * ティック割込みの処理．
+ * 動作していたEDFのスレッドの予算を消費し，使い切ったならば次の周期まで
+ * 実行を止める．また，周期の開始時刻になったスレッドを動作可能にする．
+ */
+static void tick_intr(void)
+{
+  kz_thread *thp;
+  uint32 cpsr;
+
+  timer_tick_clear();
+
+  /* ネストした割込みのハンドラからも参照されるので，割込み禁止で処理する */
+  INTR_SAVE(cpsr);
+  spin_lock(&kernel_lock);
+  ticks++;
+
+  thp = intr_thread;
+  if (thp && THREAD_IS_EDF(thp) && (thp->flags & KZ_THREAD_FLAG_READY)) {
+    if (thp->edf.remaining)
+      thp->edf.remaining--;
+    if (!thp->edf.remaining) { /* 予算超過 */
+      thp->edf.overruns++;
+      readyque_remove(thp);
+      edf_sleep(thp);
+    }
+  }
+
+  while (edfsleepers && !TICK_BEFORE(ticks, edfsleepers->edf.release)) {
+    thp = edfsleepers;
+    edfsleepers = thp->next;
+    thp->next = NULL;
+    thp->flags &= ~KZ_THREAD_FLAG_EDFWAIT;
+    /* 予算超過で止めていたジョブがデッドラインを過ぎていればミス */
+    if (TICK_BEFORE(thp->edf.abs_deadline, ticks))
+      thp->edf.misses++;
+    edf_release(thp);
+  }
+  spin_unlock(&kernel_lock);
+  INTR_RESTORE(cpsr);
+}
+
 /* システム・コールの処理(kz_kmalloc():動的メモリ獲得) */
 static void *thread_kmalloc(int size)
 {
@@ -293,20 +1080,104 @@ static int thread_kmfree(char *p)
   return 0;
 }
 
-/* メッセージの送信処理 */
-static void sendmsg(kz_msgbox *mboxp, kz_thread *thp, int size, char *p)
+static kz_msgbox *msgbox_get(kz_msgbox_id_t id)
 {
-  kz_msgbuf *mp;
+  if ((id < 0) || (id >= MSGBOX_NUM) ||
+      !(msgboxes[id].flags & KZ_MSGBOX_FLAG_USED))
+    return NULL;
+  return &msgboxes[id];
+}
+
+/* システム・コールの処理(kz_msgbox_create():メッセージ・ボックスの生成) */
+static kz_msgbox_id_t thread_msgbox_create(int attr)
+{
+  int i;
+  kz_msgbox *mboxp;
+
+  putcurrent();
+
+  /* 静的に割り当てられたもの以降から，空いているものを検索 */
+  for (i = MSGBOX_ID_NUM; i < MSGBOX_NUM; i++) {
+    mboxp = &msgboxes[i];
+    if (!(mboxp->flags & KZ_MSGBOX_FLAG_USED)) /* 見つかった */
+      break;
+  }
+  if (i == MSGBOX_NUM) /* 見つからなかった */
+    return -1;
+
+  mboxp->receiver = NULL;
+  mboxp->head     = NULL;
+  mboxp->tail     = NULL;
+  mboxp->flags    = KZ_MSGBOX_FLAG_USED;
+  mboxp->owner    = NULL;
+  if (attr & KZ_MSGBOX_ATTR_PRIORITY)
+    mboxp->flags |= KZ_MSGBOX_FLAG_PRIORITY;
+
+  return i;
+}
+
+/* システム・コールの処理(kz_msgbox_destroy():メッセージ・ボックスの削除) */
+static int thread_msgbox_destroy(kz_msgbox_id_t id)
+{
+  kz_msgbox *mboxp = msgbox_get(id);
+  kz_thread *thp;
+
+  putcurrent();
+
+  /* 静的なものと，未受信のメッセージが残っているものは削除できない */
+  if ((mboxp == NULL) || (id < MSGBOX_ID_NUM) || mboxp->head)
+    return -1;
+
+  /* 受信待ちスレッドは，受信失敗(-1)としてすべてブロック解除する */
+  while ((thp = waitque_pop(&mboxp->receiver)) != NULL) {
+    if (thp->syscall.type == KZ_SYSCALL_TYPE_RECVV)
+      thp->syscall.param->un.recvv.ret = -1;
+    else
+      thp->syscall.param->un.recv.ret = -1;
+    current = thp;
+    putcurrent();
+  }
+
+  /* kz_select() で待っているスレッドも，エラー(-1)としてブロック解除する */
+  select_abort(id);
+
+  mboxp->flags = 0;
+
+  return 0;
+}
+
+/* メッセージの送信処理(作成したメッセージ・バッファを返す) */
+static kz_msgbuf *sendmsg(kz_msgbox *mboxp, kz_thread *thp, int priority,
+			  int size, char *p)
+{
+  kz_msgbuf *mp, **mpp;
 
   /* メッセージ・バッファの作成 */
   mp = (kz_msgbuf *)kzmem_alloc(sizeof(*mp));
   if (mp == NULL)
     kz_sysdown();
   mp->next       = NULL;
-  mp->sender     = thp;
+  mp->sender     = thp ? THREAD_ID(thp) : 0; /* 割込みからの送信は0 */
+  mp->priority   = priority;
+  mp->flags      = 0;
   mp->param.size = size;
   mp->param.p    = p;
 
+  /*
+   * 優先度順のメッセージ・ボックスでは，優先度の高い順(同じ優先度の中では
+   * 到着順)に並べる．末尾より優先度が高くない場合は末尾に繋げばよいので，
+   * 先頭からの検索が必要になるのは追い越しが発生する場合のみとなる．
+   */
+  if ((mboxp->flags & KZ_MSGBOX_FLAG_PRIORITY) &&
+      mboxp->tail && (mboxp->tail->priority > priority)) {
+    for (mpp = &mboxp->head; (*mpp)->priority <= priority;
+	 mpp = &(*mpp)->next)
+      ;
+    mp->next = *mpp;
+    *mpp = mp;
+    return mp;
+  }
+
   /* メッセージ・ボックスの末尾にメッセージを接続する */
   if (mboxp->tail) {
     mboxp->tail->next = mp;
@@ -314,78 +1185,788 @@ static void sendmsg(kz_msgbox *mboxp, kz_thread *thp, int size, char *p)
     mboxp->head = mp;
   }
   mboxp->tail = mp;
+
+  return mp;
+}
+
+/*
+ * 優先度順のメッセージ・ボックスから受信するサーバ・スレッドは，
+ * 処理中のメッセージと未受信のメッセージのうち最も高い優先度を継承する．
+ * (優先度の低いサーバ・スレッドを経由した優先度逆転を抑えるため)
+ */
+static int msgbox_inherited_priority(kz_thread *thp)
+{
+  int i, priority = thp->msgpri;
+  kz_msgbox *mboxp;
+
+  for (i = 0; i < MSGBOX_NUM; i++) {
+    mboxp = &msgboxes[i];
+    if ((mboxp->owner == thp) && mboxp->head &&
+	(mboxp->head->priority < priority))
+      priority = mboxp->head->priority;
+  }
+
+  return priority;
 }
 
-/* メッセージの受信処理 */
-static void recvmsg(kz_msgbox *mboxp)
+/* メッセージ・ボックスの先頭にあるメッセージを抜き出す */
+static kz_msgbuf *msgbox_pop(kz_msgbox *mboxp)
 {
   kz_msgbuf *mp;
-  kz_syscall_param_t *p;
 
-  /* メッセージ・ボックスの先頭にあるメッセージを抜き出す */
   mp = mboxp->head;
   mboxp->head = mp->next;
   if (mboxp->head == NULL)
     mboxp->tail = NULL;
   mp->next = NULL;
 
-  /* メッセージを受信するスレッドに返す値を設定する */
-  p = mboxp->receiver->syscall.param;
-  p->un.recv.ret = (kz_thread_id_t)mp->sender;
-  if (p->un.recv.sizep)
-    *(p->un.recv.sizep) = mp->param.size;
-  if (p->un.recv.pp)
-    *(p->un.recv.pp) = mp->param.p;
-
-  /* 受信待ちスレッドはいなくなったので，NULLに戻す */
-  mboxp->receiver = NULL;
-
-  /* メッセージ・バッファの解放 */
-  kzmem_free(mp);
+  return mp;
 }
 
-/* システム・コールの処理(kz_send():メッセージ送信) */
-static int thread_send(kz_msgbox_id_t id, int size, char *p)
+/*
+ * kz_call() のメッセージならば，受信したスレッドを呼び出し元の応答相手として
+ * 記録する．(応答せずに終了した場合に，呼び出し元をエラーで起こすため)
+ */
+static void call_accept(kz_msgbuf *mp, kz_thread *thp)
 {
-  kz_msgbox *mboxp = &msgboxes[id];
+  kz_thread *client;
 
-  putcurrent();
-  sendmsg(mboxp, current, size, p); /* メッセージの送信処理 */
+  if (!(mp->flags & KZ_MSGBUF_FLAG_CALL))
+    return;
+  client = thread_lookup(mp->sender);
+  if (client && (client->flags & KZ_THREAD_FLAG_CALL))
+    client->server = thp;
+}
 
-  /* 受信待ちスレッドが存在している場合には受信処理を行う */
-  if (mboxp->receiver) {
-    current = mboxp->receiver; /* 受信待ちスレッド */
-    recvmsg(mboxp); /* メッセージの受信処理 */
-    putcurrent(); /* 受信により動作可能になったので，ブロック解除する */
+/*
+ * メッセージの受信処理．
+ * kz_recvv() による受信の場合は，受信可能なメッセージを指定された
+ * 個数までまとめて受信する．
+ */
+static void recvmsg(kz_msgbox *mboxp, kz_thread *thp)
+{
+  kz_msgbuf *mp;
+  kz_syscall_param_t *p;
+  kz_msgvec_t *vec;
+  int n, priority;
+
+  /* メッセージを受信するスレッドに返す値を設定する */
+  p = thp->syscall.param;
+  if (thp->syscall.type == KZ_SYSCALL_TYPE_RECVV) {
+    /* 先頭のメッセージが最も優先度が高いので，その優先度を継承に使う */
+    priority = mboxp->head->priority;
+    vec = p->un.recvv.vec;
+    for (n = 0; (n < p->un.recvv.num) && mboxp->head; n++) {
+      mp = msgbox_pop(mboxp);
+      vec[n].id   = mp->sender;
+      vec[n].size = mp->param.size;
+      vec[n].p    = mp->param.p;
+      call_accept(mp, thp);
+      kzmem_free(mp); /* メッセージ・バッファの解放 */
+    }
+    p->un.recvv.ret = n;
+  } else {
+    mp = msgbox_pop(mboxp);
+    priority = mp->priority;
+    p->un.recv.ret = mp->sender;
+    if (p->un.recv.sizep)
+      *(p->un.recv.sizep) = mp->param.size;
+    if (p->un.recv.pp)
+      *(p->un.recv.pp) = mp->param.p;
+    call_accept(mp, thp);
+    kzmem_free(mp); /* メッセージ・バッファの解放 */
   }
 
-  return size;
+  /* 受信したスレッドを優先度継承の対象にする */
+  if (mboxp->flags & KZ_MSGBOX_FLAG_PRIORITY) {
+    mboxp->owner = thp;
+    thp->msgpri = priority;
+    thread_update_priority(thp);
+  }
 }
 
-/* システム・コールの処理(kz_recv():メッセージ受信) */
-static kz_thread_id_t thread_recv(kz_msgbox_id_t id, int *sizep, char **pp)
+/*
+ * kz_select() で指定されたメッセージ・ボックスのうち，受信可能なものを
+ * 調べる．受信可能なものに対応するビットを立てて，その個数を返す．
+ * (メッセージ・ボックス以外の待ち要因を追加する場合は，ここで判定する)
+ */
+static int select_check(kz_syscall_param_t *p)
 {
-  kz_msgbox *mboxp = &msgboxes[id];
+  int i, n = 0;
+  uint32 ready = 0;
+  kz_msgbox *mboxp;
+
+  for (i = 0; i < p->un.select.num; i++) {
+    mboxp = msgbox_get(p->un.select.ids[i]);
+    if (mboxp && mboxp->head) {
+      ready |= (uint32)1 << i;
+      n++;
+    }
+  }
+  if (p->un.select.readyp)
+    *(p->un.select.readyp) = ready;
 
-  if (mboxp->receiver) /* 他のスレッドがすでに受信待ちしている */
-    kz_sysdown();
+  return n;
+}
 
-  mboxp->receiver = current; /* 受信待ちスレッドに設定 */
+/* kz_select() で待っているスレッドのうち，受信可能になったものを起こす */
+static void select_wakeup(void)
+{
+  kz_thread **thpp = &selectors;
+  kz_thread *thp;
+  int n;
+
+  while (*thpp) {
+    thp = *thpp;
+    n = select_check(thp->syscall.param);
+    if (n == 0) {
+      thpp = &thp->next;
+      continue;
+    }
+    waitque_remove(thp);
+    thp->syscall.param->un.select.ret = n;
+    current = thp;
+    putcurrent();
+  }
+}
+
+/*
+ * 削除されるメッセージ・ボックスを kz_select() で待っているスレッドを，
+ * エラー(-1)で起こす．(待ち続けても受信できないため)
+ */
+static void select_abort(kz_msgbox_id_t id)
+{
+  kz_thread **thpp = &selectors;
+  kz_thread *thp;
+  kz_syscall_param_t *p;
+  int i;
+
+  while (*thpp) {
+    thp = *thpp;
+    p = thp->syscall.param;
+    for (i = 0; i < p->un.select.num; i++) {
+      if (p->un.select.ids[i] == id)
+	break;
+    }
+    if (i == p->un.select.num) {
+      thpp = &thp->next;
+      continue;
+    }
+    waitque_remove(thp);
+    if (p->un.select.readyp)
+      *(p->un.select.readyp) = 0;
+    p->un.select.ret = -1;
+    current = thp;
+    putcurrent();
+  }
+}
+
+/*
+ * 受信待ちスレッドへの配送処理．
+ * 待ちキューの先頭(最も優先度の高いスレッド)から順に，メッセージが
+ * 無くなるまで受信させる．
+ */
+static void msgbox_deliver(kz_msgbox *mboxp)
+{
+  kz_thread *thp = current;
+
+  while (mboxp->receiver && mboxp->head) {
+    current = waitque_pop(&mboxp->receiver); /* 受信待ちスレッド */
+    recvmsg(mboxp, current); /* メッセージの受信処理 */
+    putcurrent(); /* 受信により動作可能になったので，ブロック解除する */
+  }
+
+  /* 未受信のメッセージの優先度をサーバ・スレッドに継承させる */
+  if (mboxp->head && mboxp->owner && (mboxp->owner != thp))
+    thread_update_priority(mboxp->owner);
+
+  /* 受信可能になったので，kz_select() で待っているスレッドを起こす */
+  if (mboxp->head && selectors)
+    select_wakeup();
+  current = thp;
+}
+
+/* システム・コールの処理(kz_send():メッセージ送信) */
+static int thread_send(kz_msgbox_id_t id, int priority, int size, char *p)
+{
+  kz_msgbox *mboxp = msgbox_get(id);
+
+  putcurrent();
+  if (mboxp == NULL)
+    return -1;
+
+  /*
+   * 優先度の指定が無い場合は，送信したスレッドの優先度とする．
+   * (サービス・コールの場合は送信スレッドが無いので，最低優先度とする)
+   */
+  if (priority < 0)
+    priority = current ? current->priority : PRIORITY_NUM - 1;
+
+  /* メッセージの送信処理 */
+  sendmsg(mboxp, current, priority, size, p);
+
+  /* 受信待ちスレッドが存在している場合には受信処理を行う */
+  msgbox_deliver(mboxp);
+
+  return size;
+}
+
+/* システム・コールの処理(kz_sendv():メッセージの一括送信) */
+static int thread_sendv(kz_msgbox_id_t id, kz_msgvec_t *vec, int num)
+{
+  kz_msgbox *mboxp = msgbox_get(id);
+  int i;
+
+  putcurrent();
+  if ((mboxp == NULL) || (num <= 0))
+    return -1;
+
+  /* すべて接続してから，受信待ちスレッドにまとめて配送する */
+  for (i = 0; i < num; i++)
+    sendmsg(mboxp, current, current->priority, vec[i].size, vec[i].p);
+  msgbox_deliver(mboxp);
+
+  return num;
+}
+
+/* システム・コールの処理(kz_recv():メッセージ受信) */
+static kz_thread_id_t thread_recv(kz_msgbox_id_t id, int *sizep, char **pp)
+{
+  kz_msgbox *mboxp = msgbox_get(id);
+
+  if (mboxp == NULL) {
+    putcurrent();
+    return -1;
+  }
+
+  /*
+   * 次のメッセージの受信に来たので，前回受信したメッセージの処理は
+   * 終わっている．継承していた優先度を元に戻す．
+   */
+  current->msgpri = PRIORITY_NUM;
+  thread_update_priority(current);
 
   if (mboxp->head == NULL) {
     /*
-     * メッセージ・ボックスにメッセージが無いので，スレッドを
-     * スリープさせる．(システム・コールがブロックする)
+     * メッセージ・ボックスにメッセージが無いので，受信待ちキューに
+     * 接続してスレッドをスリープさせる．(システム・コールがブロックする)
      */
+    waitque_insert(&mboxp->receiver, current);
     return -1;
   }
 
-  recvmsg(mboxp); /* メッセージの受信処理 */
+  recvmsg(mboxp, current); /* メッセージの受信処理 */
   putcurrent(); /* メッセージを受信できたので，レディー状態にする */
 
   return current->syscall.param->un.recv.ret;
 }
 
+/* システム・コールの処理(kz_recvv():メッセージの一括受信) */
+static int thread_recvv(kz_msgbox_id_t id, kz_msgvec_t *vec, int num)
+{
+  kz_msgbox *mboxp = msgbox_get(id);
+
+  if ((mboxp == NULL) || (num <= 0)) {
+    putcurrent();
+    return -1;
+  }
+
+  /* 継承していた優先度を元に戻す(thread_recv()と同様) */
+  current->msgpri = PRIORITY_NUM;
+  thread_update_priority(current);
+
+  if (mboxp->head == NULL) {
+    /*
+     * メッセージが１つも無い場合のみスリープする．
+     * 届いた時点で，そのとき受信可能なぶんがまとめて返される．
+     */
+    waitque_insert(&mboxp->receiver, current);
+    return 0;
+  }
+
+  recvmsg(mboxp, current); /* 受信可能なぶんをまとめて受信する */
+  putcurrent();
+
+  return current->syscall.param->un.recvv.ret;
+}
+
+/*
+ * kz_call()/kz_reply() の相手に実行権を直接引き渡す．
+ * 相手をレディー・キューの先頭に繋ぐだけで，レディー・キューを経由せずに
+ * 切り替えることはしない．動作中のスレッドはレディー・キューの先頭にある
+ * ことを前提に，割込みによる横取りや getcurrent() が動作しているため，
+ * キューに無いスレッドを current にすると，次の割込みでそのスレッドが
+ * 失われてしまう．先頭に繋いでおけば，次の schedule() のビットマップ検索で
+ * そのまま選ばれるので，キューの走査は発生しない．
+ */
+static void thread_handoff(kz_thread *thp)
+{
+  readyque_prepend(thp);
+}
+
+/*
+ * システム・コールの処理(kz_call():メッセージ送信と応答待ち)
+ * 受信待ちのサーバ・スレッドがいれば，実行権を直接引き渡す．
+ * サーバの優先度が動作可能な他のスレッド以上ならば，そのままサーバに
+ * 切り替わる．
+ */
+static int thread_call(kz_msgbox_id_t id, int size, char *p)
+{
+  kz_msgbox *mboxp = msgbox_get(id);
+  kz_thread *server;
+  kz_msgbuf *mp;
+
+  if (mboxp == NULL) {
+    putcurrent();
+    return -1;
+  }
+
+  /* kz_reply() で応答されるまで，呼び出し元はスリープする */
+  current->flags |= KZ_THREAD_FLAG_CALL;
+
+  current->server = NULL;
+
+  server = mboxp->receiver;
+  mp = sendmsg(mboxp, current, current->priority, size, p);
+  mp->flags |= KZ_MSGBUF_FLAG_CALL;
+  msgbox_deliver(mboxp);
+
+  if (server && (server->flags & KZ_THREAD_FLAG_READY)) {
+    readyque_remove(server);
+    thread_handoff(server);
+  }
+
+  return 0;
+}
+
+/*
+ * システム・コールの処理(kz_reply():kz_call()への応答)
+ * 応答を待っている呼び出し元に実行権を直接引き渡し，応答したスレッドは
+ * レディー・キューの末尾に戻す．呼び出し元の優先度が応答したスレッド
+ * 以上ならば，そのまま呼び出し元に戻る．
+ */
+static int thread_reply(kz_thread_id_t id, int size, char *p)
+{
+  kz_thread *thp = thread_lookup(id);
+  kz_syscall_param_t *cp;
+
+  putcurrent();
+
+  if ((thp == NULL) || !(thp->flags & KZ_THREAD_FLAG_CALL))
+    return -1;
+
+  thp->flags &= ~KZ_THREAD_FLAG_CALL;
+  thp->server = NULL;
+  cp = thp->syscall.param;
+  if (cp->un.call.rsizep)
+    *(cp->un.call.rsizep) = size;
+  if (cp->un.call.rpp)
+    *(cp->un.call.rpp) = p;
+  thread_handoff(thp);
+
+  return 0;
+}
+
+/*
+ * 終了するスレッドが受信して応答していない kz_call() の呼び出し元を，
+ * エラー(-1)で起こす．(currentは変化しない)
+ */
+static void call_abort(kz_thread *server)
+{
+  kz_thread *thp, *self = current;
+  int i;
+
+  for (i = 0; i < THREAD_NUM; i++) {
+    thp = &threads[i];
+    if ((thp->flags & KZ_THREAD_FLAG_CALL) && (thp->server == server)) {
+      thp->flags &= ~KZ_THREAD_FLAG_CALL;
+      thp->server = NULL;
+      thp->syscall.param->un.call.ret = -1;
+      current = thp;
+      putcurrent();
+    }
+  }
+
+  current = self;
+}
+
+/* システム・コールの処理(kz_select():複数のメッセージ・ボックスの待ち合わせ) */
+static int thread_select(kz_msgbox_id_t *ids, int num, uint32 *readyp,
+			 int wait)
+{
+  int n;
+
+  if ((num <= 0) || (num > 32)) {
+    putcurrent();
+    return -1;
+  }
+
+  /* 有効なメッセージ・ボックスが一つも無ければ，待っても起きられない */
+  for (n = 0; n < num; n++) {
+    if (msgbox_get(ids[n]))
+      break;
+  }
+  if (n == num) {
+    putcurrent();
+    return -1;
+  }
+
+  n = select_check(current->syscall.param);
+  if ((n == 0) && wait) {
+    /*
+     * 受信可能なものが無いのでスリープする．いずれかが受信可能に
+     * なった時点で select_wakeup() から起こされる．
+     */
+    waitque_insert(&selectors, current);
+    return 0;
+  }
+
+  putcurrent();
+  return n;
+}
+
+/* 待ち状態のスレッドをレディー・キューに戻す(currentは変化する) */
+static void thread_release(kz_thread *thp)
+{
+  current = thp;
+  putcurrent();
+}
+
+static kz_sem *sem_get(kz_sem_id_t id)
+{
+  if ((id < 0) || (id >= SEM_NUM) || !(sems[id].flags & KZ_SEM_FLAG_USED))
+    return NULL;
+  return &sems[id];
+}
+
+/* システム・コールの処理(kz_sem_create():セマフォの生成) */
+static kz_sem_id_t thread_sem_create(int count)
+{
+  int i;
+
+  putcurrent();
+
+  for (i = 0; i < SEM_NUM; i++) {
+    if (!(sems[i].flags & KZ_SEM_FLAG_USED)) {
+      sems[i].flags  = KZ_SEM_FLAG_USED;
+      sems[i].count  = count;
+      sems[i].waiter = NULL;
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/* システム・コールの処理(kz_sem_wait():セマフォの獲得) */
+static int thread_sem_wait(kz_sem_id_t id)
+{
+  kz_sem *semp = sem_get(id);
+
+  if (semp == NULL) {
+    putcurrent();
+    return -1;
+  }
+
+  if (semp->count > 0) {
+    semp->count--;
+    putcurrent();
+    return 0;
+  }
+
+  /* 資源が無いのでスリープする．thread_sem_post() で起こされる */
+  waitque_insert(&semp->waiter, current);
+  return 0;
+}
+
+/* システム・コールの処理(kz_sem_post():セマフォの返却) */
+static int thread_sem_post(kz_sem_id_t id)
+{
+  kz_sem *semp = sem_get(id);
+  kz_thread *thp;
+
+  putcurrent();
+  if (semp == NULL)
+    return -1;
+
+  /* 獲得待ちスレッドがいれば，カウントを経由せずに直接渡す */
+  thp = waitque_pop(&semp->waiter);
+  if (thp) {
+    thp->syscall.param->un.sem.ret = 0;
+    thread_release(thp);
+  } else {
+    semp->count++;
+  }
+
+  return 0;
+}
+
+static kz_mutex *mutex_get(kz_mutex_id_t id)
+{
+  if ((id < 0) || (id >= MUTEX_NUM) ||
+      !(mutexes[id].flags & KZ_MUTEX_FLAG_USED))
+    return NULL;
+  return &mutexes[id];
+}
+
+/* システム・コールの処理(kz_mutex_create():ミューテックスの生成) */
+static kz_mutex_id_t thread_mutex_create(void)
+{
+  int i;
+
+  putcurrent();
+
+  for (i = 0; i < MUTEX_NUM; i++) {
+    if (!(mutexes[i].flags & KZ_MUTEX_FLAG_USED)) {
+      mutexes[i].flags  = KZ_MUTEX_FLAG_USED;
+      mutexes[i].owner  = NULL;
+      mutexes[i].waiter = NULL;
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/* システム・コールの処理(kz_mutex_lock():ミューテックスのロック) */
+static int thread_mutex_lock(kz_mutex_id_t id)
+{
+  kz_mutex *mutexp = mutex_get(id);
+
+  if ((mutexp == NULL) || (mutexp->owner == current)) {
+    putcurrent(); /* 再帰的なロックはできない */
+    return -1;
+  }
+
+  if (mutexp->owner == NULL) {
+    mutexp->owner = current;
+    putcurrent();
+    return 0;
+  }
+
+  /*
+   * ロック待ちでスリープする．保持しているスレッドは，待ちスレッドの
+   * 優先度を継承する．(優先度の低いスレッドがロックを保持したまま
+   * 中優先度のスレッドに横取りされ続けるのを防ぐため)
+   */
+  waitque_insert(&mutexp->waiter, current);
+  current->wait_mutex = mutexp;
+  thread_update_priority(mutexp->owner);
+
+  return 0;
+}
+
+/* ロック待ちの先頭スレッドにミューテックスを引き渡す */
+static void mutex_handoff(kz_mutex *mutexp)
+{
+  kz_thread *thp, *owner = mutexp->owner, *self = current;
+
+  thp = waitque_pop(&mutexp->waiter);
+  mutexp->owner = thp;
+
+  /* 元の保持スレッドは，継承していた優先度を元に戻す */
+  if (owner)
+    thread_update_priority(owner);
+
+  if (thp) {
+    thp->wait_mutex = NULL;
+    thp->syscall.param->un.mutex.ret = 0;
+    thread_update_priority(thp); /* 残りの待ちスレッドの優先度を継承 */
+    thread_release(thp);
+  }
+
+  current = self;
+}
+
+/* システム・コールの処理(kz_mutex_unlock():ミューテックスのアンロック) */
+static int thread_mutex_unlock(kz_mutex_id_t id)
+{
+  kz_mutex *mutexp = mutex_get(id);
+
+  if ((mutexp == NULL) || (mutexp->owner != current)) {
+    putcurrent();
+    return -1;
+  }
+
+  /*
+   * 優先度が元に戻ってからレディー・キューに繋ぐために，
+   * putcurrent() は引き渡しの後で行う．
+   */
+  mutex_handoff(mutexp);
+  putcurrent();
+
+  return 0;
+}
+
+static kz_flag *flag_get(kz_flag_id_t id)
+{
+  if ((id < 0) || (id >= FLAG_NUM) ||
+      !(eventflags[id].flags & KZ_FLAG_FLAG_USED))
+    return NULL;
+  return &eventflags[id];
+}
+
+/* 待ち条件を満たしているか？ */
+static int flag_check(kz_flag *flagp, uint32 pattern, int mode)
+{
+  if (mode & KZ_FLAG_WAIT_OR)
+    return (flagp->pattern & pattern) ? 1 : 0;
+  return ((flagp->pattern & pattern) == pattern) ? 1 : 0;
+}
+
+/* システム・コールの処理(kz_flag_create():イベントフラグの生成) */
+static kz_flag_id_t thread_flag_create(uint32 pattern)
+{
+  int i;
+
+  putcurrent();
+
+  for (i = 0; i < FLAG_NUM; i++) {
+    if (!(eventflags[i].flags & KZ_FLAG_FLAG_USED)) {
+      eventflags[i].flags   = KZ_FLAG_FLAG_USED;
+      eventflags[i].pattern = pattern;
+      eventflags[i].waiter  = NULL;
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/* システム・コールの処理(kz_flag_wait():イベントフラグの待ち合わせ) */
+static uint32 thread_flag_wait(kz_flag_id_t id, uint32 pattern, int mode)
+{
+  kz_flag *flagp = flag_get(id);
+  uint32 ret;
+
+  if ((flagp == NULL) || (pattern == 0)) {
+    putcurrent();
+    return 0;
+  }
+
+  if (!flag_check(flagp, pattern, mode)) {
+    /* 条件を満たすまでスリープする．thread_flag_set() で起こされる */
+    waitque_insert(&flagp->waiter, current);
+    return 0;
+  }
+
+  ret = flagp->pattern;
+  if (mode & KZ_FLAG_WAIT_CLEAR)
+    flagp->pattern &= ~pattern;
+  putcurrent();
+
+  return ret;
+}
+
+/* システム・コールの処理(kz_flag_set():イベントフラグのセット) */
+static int thread_flag_set(kz_flag_id_t id, uint32 pattern)
+{
+  kz_flag *flagp = flag_get(id);
+  kz_thread **thpp, *thp;
+  kz_syscall_param_t *p;
+
+  putcurrent();
+  if (flagp == NULL)
+    return -1;
+
+  flagp->pattern |= pattern;
+
+  /* 待ちキューの先頭から順に，条件を満たしたスレッドを起こす */
+  thpp = &flagp->waiter;
+  while (*thpp) {
+    thp = *thpp;
+    p = thp->syscall.param;
+    if (!flag_check(flagp, p->un.flag.pattern, p->un.flag.mode)) {
+      thpp = &thp->next;
+      continue;
+    }
+    waitque_remove(thp);
+    p->un.flag.ret = flagp->pattern;
+    if (p->un.flag.mode & KZ_FLAG_WAIT_CLEAR)
+      flagp->pattern &= ~p->un.flag.pattern;
+    thread_release(thp);
+  }
+
+  return 0;
+}
+
+/* システム・コールの処理(kz_flag_clear():イベントフラグのクリア) */
+static int thread_flag_clear(kz_flag_id_t id, uint32 pattern)
+{
+  kz_flag *flagp = flag_get(id);
+
+  putcurrent();
+  if (flagp == NULL)
+    return -1;
+
+  flagp->pattern &= ~pattern;
+
+  return 0;
+}
+
+/* スタック領域の最下位アドレス */
+static uint32 *thread_stack_base(kz_thread *thp)
+{
+  return (uint32 *)((char *)thp->stack - thp->stacksize);
+}
+
+/*
+ * スタックのあふれの検査．
+ * ガード・ワードが書き換えられているか，スタック・ポインタが
+ * スタック領域を下回っていたら，隣接するスタックを壊しているので
+ * システムを停止する．
+ */
+static void thread_check_stack(kz_thread *thp, unsigned long sp)
+{
+  uint32 *base = thread_stack_base(thp);
+
+  if ((*base != STACK_GUARD) || (sp < (unsigned long)(base + 1))) {
+    puts((unsigned char *)thp->name);
+    puts((unsigned char *)" STACK OVERFLOW.\n");
+    kz_sysdown();
+  }
+}
+
+/*
+ * スタック使用量のピーク．
+ * 最下位から順に，パターンが残っている(一度も使われていない)部分を数える．
+ */
+static int thread_stack_used(kz_thread *thp)
+{
+  uint8 *p = (uint8 *)(thread_stack_base(thp) + 1);
+  uint8 *end = (uint8 *)thp->stack;
+
+  while ((p < end) && (*p == STACK_PAINT))
+    p++;
+
+  return end - p;
+}
+
+/* システム・コールの処理(kz_threadinfo():スレッド情報の取得) */
+static int thread_threadinfo(int index, kz_threadinfo_t *info)
+{
+  kz_thread *thp;
+
+  putcurrent();
+
+  if ((index < 0) || (index >= THREAD_NUM))
+    return -1;
+
+  thp = &threads[index];
+  if (!thp->init.func) /* 未使用 */
+    return 0;
+
+  info->id = THREAD_ID(thp);
+  strcpy(info->name, thp->name);
+  info->priority  = thp->priority;
+  info->stacksize = thp->stacksize;
+  info->stackused = thread_stack_used(thp);
+  info->misses    = thp->edf.misses;
+  info->overruns  = thp->edf.overruns;
+
+  return 1;
+}
+
 /* システム・コールの処理(kz_setintr():割込みハンドラ登録) */
 static int thread_setintr(softvec_type_t type, kz_handler_t handler)
 {
@@ -401,14 +1982,173 @@ static int thread_setintr(softvec_type_t type, kz_handler_t handler)
   return 0;
 }
 
-static void call_functions(kz_syscall_type_t type, kz_syscall_param_t *p)
+/* システム・コールの処理(kz_ring_create():リング・チャネルの生成) */
+static kz_ring_id_t thread_ring_create(int slotsize, int slotnum)
+{
+  int i;
+  kz_ring *ringp;
+
+  putcurrent();
+
+  /*
+   * スロットのサイズと個数は，領域のサイズの計算が溢れないように
+   * それぞれ RING_SIZE_MAX までとする．
+   */
+  if ((slotsize <= 0) || (slotnum <= 0) ||
+      (slotsize > RING_SIZE_MAX) || (slotnum > RING_SIZE_MAX))
+    return -1;
+
+  /* 空いているリング・チャネルを検索 */
+  for (i = 0; i < RING_NUM; i++) {
+    ringp = &rings[i];
+    if (!ringp->buffer) /* 見つかった */
+      break;
+  }
+  if (i == RING_NUM) /* 見つからなかった */
+    return -1;
+
+  slotsize = (slotsize + 3) & ~3; /* スロットは4バイト境界に揃える */
+
+  /* スロット領域は生成時に一度だけ獲得し，以降は再利用する */
+  ringp->buffer = kzmem_alloc_static(slotsize * slotnum);
+  if (ringp->buffer == NULL) /* 空き領域が足りない */
+    return -1;
+  ringp->slotsize = slotsize;
+  ringp->slotnum  = slotnum;
+  ringp->head     = 0;
+  ringp->tail     = 0;
+  ringp->count    = 0;
+  ringp->producer = NULL;
+  ringp->consumer = NULL;
+
+  return i;
+}
+
+static kz_ring *ring_get(kz_ring_id_t id)
+{
+  if ((id < 0) || (id >= RING_NUM) || !rings[id].buffer)
+    return NULL;
+  return &rings[id];
+}
+
+static char *ring_slot(kz_ring *ringp, int index)
+{
+  return ringp->buffer + index * ringp->slotsize;
+}
+
+/* システム・コールの処理(kz_ring_reserve():書き込みスロットの予約) */
+static void *thread_ring_reserve(kz_ring_id_t id)
+{
+  kz_ring *ringp = ring_get(id);
+
+  if (ringp == NULL) {
+    putcurrent();
+    return NULL;
+  }
+
+  if (ringp->count == ringp->slotnum) {
+    /*
+     * 空きスロットが無いので，スレッドをスリープさせる．
+     * 空きができた時点で thread_ring_release() から予約スロットが返される．
+     */
+    if (ringp->producer) /* 他のスレッドがすでに空き待ちしている */
+      kz_sysdown();
+    ringp->producer = current;
+    current->flags |= KZ_THREAD_FLAG_RINGWAIT;
+    return NULL;
+  }
+
+  putcurrent();
+  return ring_slot(ringp, ringp->tail);
+}
+
+/* システム・コールの処理(kz_ring_commit():書き込みスロットの確定) */
+static int thread_ring_commit(kz_ring_id_t id)
+{
+  kz_ring *ringp = ring_get(id);
+
+  putcurrent();
+
+  if ((ringp == NULL) || (ringp->count == ringp->slotnum))
+    return -1;
+
+  if (++ringp->tail == ringp->slotnum)
+    ringp->tail = 0;
+  ringp->count++;
+
+  /* データ待ちスレッドが存在している場合には，先頭のスロットを渡す */
+  if (ringp->consumer) {
+    current = ringp->consumer;
+    ringp->consumer = NULL;
+    current->flags &= ~KZ_THREAD_FLAG_RINGWAIT;
+    current->syscall.param->un.ring_peek.ret = ring_slot(ringp, ringp->head);
+    putcurrent(); /* データを受け取れたので，ブロック解除する */
+  }
+
+  return 0;
+}
+
+/* システム・コールの処理(kz_ring_peek():読み出しスロットの参照) */
+static void *thread_ring_peek(kz_ring_id_t id)
+{
+  kz_ring *ringp = ring_get(id);
+
+  if (ringp == NULL) {
+    putcurrent();
+    return NULL;
+  }
+
+  if (ringp->count == 0) {
+    /*
+     * 読み出せるスロットが無いので，スレッドをスリープさせる．
+     * コミットされた時点で thread_ring_commit() からスロットが返される．
+     */
+    if (ringp->consumer) /* 他のスレッドがすでにデータ待ちしている */
+      kz_sysdown();
+    ringp->consumer = current;
+    current->flags |= KZ_THREAD_FLAG_RINGWAIT;
+    return NULL;
+  }
+
+  putcurrent();
+  return ring_slot(ringp, ringp->head);
+}
+
+/* システム・コールの処理(kz_ring_release():読み出しスロットの解放) */
+static int thread_ring_release(kz_ring_id_t id)
+{
+  kz_ring *ringp = ring_get(id);
+
+  putcurrent();
+
+  if ((ringp == NULL) || (ringp->count == 0))
+    return -1;
+
+  if (++ringp->head == ringp->slotnum)
+    ringp->head = 0;
+  ringp->count--;
+
+  /* 空き待ちスレッドが存在している場合には，空いたスロットを予約させる */
+  if (ringp->producer) {
+    current = ringp->producer;
+    ringp->producer = NULL;
+    current->flags &= ~KZ_THREAD_FLAG_RINGWAIT;
+    current->syscall.param->un.ring_reserve.ret = ring_slot(ringp, ringp->tail);
+    putcurrent(); /* 空きができたので，ブロック解除する */
+  }
+
+  return 0;
+}
+
+static KZ_HOT void call_functions(kz_syscall_type_t type, kz_syscall_param_t *p)
 {
   /* システム・コールの実行中にcurrentが書き換わるので注意 */
   switch (type) {
   case KZ_SYSCALL_TYPE_RUN: /* kz_run() */
     p->un.run.ret = thread_run(p->un.run.func, p->un.run.name,
 			       p->un.run.priority, p->un.run.stacksize,
-			       p->un.run.argc, p->un.run.argv);
+			       p->un.run.argc, p->un.run.argv,
+			       p->un.run.affinity);
     break;
   case KZ_SYSCALL_TYPE_EXIT: /* kz_exit() */
     /* TCBが消去されるので，戻り値を書き込んではいけない */
@@ -436,24 +2176,110 @@ static void call_functions(kz_syscall_type_t type, kz_syscall_param_t *p)
     p->un.kmfree.ret = thread_kmfree(p->un.kmfree.p);
     break;
   case KZ_SYSCALL_TYPE_SEND: /* kz_send() */
-    p->un.send.ret = thread_send(p->un.send.id,
+    p->un.send.ret = thread_send(p->un.send.id, p->un.send.priority,
 				 p->un.send.size, p->un.send.p);
     break;
   case KZ_SYSCALL_TYPE_RECV: /* kz_recv() */
     p->un.recv.ret = thread_recv(p->un.recv.id,
 				 p->un.recv.sizep, p->un.recv.pp);
     break;
+  case KZ_SYSCALL_TYPE_SENDV: /* kz_sendv() */
+    p->un.sendv.ret = thread_sendv(p->un.sendv.id,
+				   p->un.sendv.vec, p->un.sendv.num);
+    break;
+  case KZ_SYSCALL_TYPE_RECVV: /* kz_recvv() */
+    p->un.recvv.ret = thread_recvv(p->un.recvv.id,
+				   p->un.recvv.vec, p->un.recvv.num);
+    break;
+  case KZ_SYSCALL_TYPE_CALL: /* kz_call() */
+    p->un.call.ret = thread_call(p->un.call.id, p->un.call.size, p->un.call.p);
+    break;
+  case KZ_SYSCALL_TYPE_REPLY: /* kz_reply() */
+    p->un.reply.ret = thread_reply(p->un.reply.id,
+				   p->un.reply.size, p->un.reply.p);
+    break;
+  case KZ_SYSCALL_TYPE_SELECT: /* kz_select(), kz_poll() */
+    p->un.select.ret = thread_select(p->un.select.ids, p->un.select.num,
+				     p->un.select.readyp, p->un.select.wait);
+    break;
+  case KZ_SYSCALL_TYPE_SEM_CREATE: /* kz_sem_create() */
+    p->un.sem.ret = thread_sem_create(p->un.sem.count);
+    break;
+  case KZ_SYSCALL_TYPE_SEM_WAIT: /* kz_sem_wait() */
+    p->un.sem.ret = thread_sem_wait(p->un.sem.id);
+    break;
+  case KZ_SYSCALL_TYPE_SEM_POST: /* kz_sem_post() */
+    p->un.sem.ret = thread_sem_post(p->un.sem.id);
+    break;
+  case KZ_SYSCALL_TYPE_MUTEX_CREATE: /* kz_mutex_create() */
+    p->un.mutex.ret = thread_mutex_create();
+    break;
+  case KZ_SYSCALL_TYPE_MUTEX_LOCK: /* kz_mutex_lock() */
+    p->un.mutex.ret = thread_mutex_lock(p->un.mutex.id);
+    break;
+  case KZ_SYSCALL_TYPE_MUTEX_UNLOCK: /* kz_mutex_unlock() */
+    p->un.mutex.ret = thread_mutex_unlock(p->un.mutex.id);
+    break;
+  case KZ_SYSCALL_TYPE_FLAG_CREATE: /* kz_flag_create() */
+    p->un.flag.ret = thread_flag_create(p->un.flag.pattern);
+    break;
+  case KZ_SYSCALL_TYPE_FLAG_WAIT: /* kz_flag_wait() */
+    p->un.flag.ret = thread_flag_wait(p->un.flag.id, p->un.flag.pattern,
+				      p->un.flag.mode);
+    break;
+  case KZ_SYSCALL_TYPE_FLAG_SET: /* kz_flag_set() */
+    p->un.flag.ret = thread_flag_set(p->un.flag.id, p->un.flag.pattern);
+    break;
+  case KZ_SYSCALL_TYPE_FLAG_CLEAR: /* kz_flag_clear() */
+    p->un.flag.ret = thread_flag_clear(p->un.flag.id, p->un.flag.pattern);
+    break;
+  case KZ_SYSCALL_TYPE_EDF: /* kz_edf() */
+    p->un.edf.ret = thread_edf(p->un.edf.period, p->un.edf.budget,
+			       p->un.edf.deadline);
+    break;
+  case KZ_SYSCALL_TYPE_EDF_WAIT: /* kz_edf_wait() */
+    p->un.edf_wait.ret = thread_edf_wait();
+    break;
+  case KZ_SYSCALL_TYPE_IPI: /* kz_ipi() */
+    p->un.ipi.ret = thread_ipi(p->un.ipi.cpumask, p->un.ipi.reasons);
+    break;
+  case KZ_SYSCALL_TYPE_THREADINFO: /* kz_threadinfo() */
+    p->un.threadinfo.ret = thread_threadinfo(p->un.threadinfo.index,
+					     p->un.threadinfo.info);
+    break;
   case KZ_SYSCALL_TYPE_SETINTR: /* kz_setintr() */
     p->un.setintr.ret = thread_setintr(p->un.setintr.type,
 				       p->un.setintr.handler);
     break;
+  case KZ_SYSCALL_TYPE_MSGBOX_CREATE: /* kz_msgbox_create() */
+    p->un.msgbox_create.ret = thread_msgbox_create(p->un.msgbox_create.attr);
+    break;
+  case KZ_SYSCALL_TYPE_MSGBOX_DESTROY: /* kz_msgbox_destroy() */
+    p->un.msgbox_destroy.ret = thread_msgbox_destroy(p->un.msgbox_destroy.id);
+    break;
+  case KZ_SYSCALL_TYPE_RING_CREATE: /* kz_ring_create() */
+    p->un.ring_create.ret = thread_ring_create(p->un.ring_create.slotsize,
+					       p->un.ring_create.slotnum);
+    break;
+  case KZ_SYSCALL_TYPE_RING_RESERVE: /* kz_ring_reserve() */
+    p->un.ring_reserve.ret = thread_ring_reserve(p->un.ring_reserve.id);
+    break;
+  case KZ_SYSCALL_TYPE_RING_COMMIT: /* kz_ring_commit() */
+    p->un.ring_commit.ret = thread_ring_commit(p->un.ring_commit.id);
+    break;
+  case KZ_SYSCALL_TYPE_RING_PEEK: /* kz_ring_peek() */
+    p->un.ring_peek.ret = thread_ring_peek(p->un.ring_peek.id);
+    break;
+  case KZ_SYSCALL_TYPE_RING_RELEASE: /* kz_ring_release() */
+    p->un.ring_release.ret = thread_ring_release(p->un.ring_release.id);
+    break;
   default:
     break;
   }
 }
 
 /* システム・コールの処理 */
-static void syscall_proc(kz_syscall_type_t type, kz_syscall_param_t *p)
+static KZ_HOT void syscall_proc(kz_syscall_type_t type, kz_syscall_param_t *p)
 {
   /*
    * システム・コールを呼び出したスレッドをレディー・キューから
@@ -481,43 +2307,225 @@ static void srvcall_proc(kz_syscall_type_t type, kz_syscall_param_t *p)
   call_functions(type, p);
 }
 
+#if KZ_CPU_NUM > 1
+/*
+ * 他のコアからのスレッドの移動(ワーク・スティーリング)．
+ * レディー・キューに接続されているスレッドの最も多いコアから，
+ * priority 以上の優先度のスレッドを1つ，動作中のコアに移動する．
+ * 同じ優先度の中では最後に実行されるキューの末尾のものを選ぶ．
+ */
+static void steal(int priority)
+{
+  kz_cpu *victim = NULL, *cpu = CPU;
+  kz_thread *thp, *cand;
+  int i;
+
+  for (i = 0; i < KZ_CPU_NUM; i++) {
+    if ((&cpus[i] != cpu) && (!victim || (cpus[i].nready > victim->nready)))
+      victim = &cpus[i];
+  }
+  if (!victim)
+    return;
+
+  for (i = 0; i <= priority; i++) {
+    cand = NULL;
+    for (thp = victim->readyque[i].head; thp; thp = thp->next) {
+      /*
+       * そのコアで動作中のスレッド(割込みハンドラの実行中ならば，そのスタック
+       * を使っているスレッド)や，動作中のコアに移動できないスレッド，
+       * VFPレジスタがそのコアに残っているスレッドは対象外．
+       */
+      if (!cpu_is_busy(victim, thp) &&
+	  (thp->affinity & ((uint32)1 << cpu_id())))
+	cand = thp;
+    }
+    if (cand) {
+      readyque_remove(cand);
+      cand->cpu = cpu_id();
+      readyque_append(cand);
+      return;
+    }
+  }
+}
+#endif
+
 /* スレッドのスケジューリング */
-static void schedule(void)
+static KZ_HOT void schedule(void)
 {
   int i;
 
   /*
    * 優先順位の高い順(優先度の数値の小さい順)にレディー・キューを見て，
    * 動作可能なスレッドを検索する．
+   * レディー・キューを順に見る代わりに，ビットマップの最下位の
+   * セットされたビットを求める．
    */
-  for (i = 0; i < PRIORITY_NUM; i++) {
-    if (readyque[i].head) /* 見つかった */
-      break;
-  }
-  if (i == PRIORITY_NUM) /* 見つからなかった */
+  kz_cpu *cpu = CPU;
+
+#if KZ_CPU_NUM > 1
+  /*
+   * アイドル・スレッドの優先度のスレッドしか無ければ，
+   * 他のコアからスレッドを移動してくる．
+   */
+  if (!(cpu->readymap & (((uint32)1 << IDLE_PRIORITY) - 1)))
+    steal(IDLE_PRIORITY - 1);
+#endif
+
+  if (cpu->readymap == 0) /* 見つからなかった */
     kz_sysdown();
+  i = __builtin_ctz(cpu->readymap);
 
-  current = readyque[i].head; /* カレント・スレッドに設定する */
+  /* EDFの優先度では，デッドラインの最も早いスレッドを優先する */
+  if ((i == EDF_PRIORITY) && (cpu == &cpus[EDF_CPU]) && edfheap_num)
+    current = edfheap[0];
+  else
+    current = cpu->readyque[i].head; /* カレント・スレッドに設定する */
 }
 
-static void syscall_intr(void)
+/*
+ * システム・コールの種別とパラメータは kz_syscall() から r0, r1 で渡され，
+ * 割込みの入口でスタック上のコンテキストに保存されている．
+ */
+static KZ_HOT void syscall_intr(void)
 {
+  kz_arm_context *thc = (kz_arm_context *)current->context.sp;
+
+  current->syscall.type  = thc->r[0];
+  current->syscall.param = (kz_syscall_param_t *)thc->r[1];
   syscall_proc(current->syscall.type, current->syscall.param);
 }
 
 static void softerr_intr(void)
 {
-  puts(current->name);
-  puts(" DOWN.\n");
+  kprintf(KLOG_ERR, "%s DOWN.\n", current->name);
   getcurrent(); /* レディーキューから外す */
   thread_exit(); /* スレッド終了する */
 }
 
+/*
+ * VFPレジスタの遅延切替え．
+ * VFPレジスタはスレッドの切替え時には退避/復旧せず，VFPを無効にしておく．
+ * 別のスレッドがVFP命令を実行すると未定義命令例外でここに来るので，
+ * その時点で前の所有スレッドのレジスタを退避し，カレント・スレッドの
+ * レジスタを復旧する．VFPを使わないスレッドには切替えのコストがかからない．
+ * 処理できた場合は0を返し，トラップした命令が再実行される．
+ */
+int vfp_trap(void)
+{
+  /* VFPが有効なのに例外が発生したならば，本当の未定義命令 */
+  if ((current == NULL) || (vfp_get_fpexc() & VFP_FPEXC_EN))
+    return -1;
+
+  vfp_set_fpexc(VFP_FPEXC_EN);
+  if (vfp_owner != current) {
+    if (vfp_owner)
+      vfp_save(vfp_owner->vfpregs);
+    vfp_restore(current->vfpregs);
+    vfp_owner = current;
+  }
+  current->flags |= KZ_THREAD_FLAG_VFP;
+
+  return 0;
+}
+
+/* ディスパッチするスレッドがVFPレジスタを保持しているときのみVFPを有効にする */
+static KZ_HOT void vfp_switch(void)
+{
+  vfp_set_fpexc((current == vfp_owner) ? VFP_FPEXC_EN : 0);
+}
+
+/*
+ * IRQの処理．
+ * 割込みコントローラで要因を判別し，同じ優先度以下のIRQをマスクしてから
+ * 割込みを許可してハンドラを呼び出す．ハンドラの実行中は，より優先度の
+ * 高いIRQのみがネストして発生する．
+ */
+static KZ_HOT void irq_intr(void)
+{
+  softvec_type_t type;
+  uint32 start, prev;
+
+  /* ネストした割込みで上書きされる前に，割込み発生時刻を得ておく */
+  start = latency_irq_entry[cpu_id()];
+  if (intr_nest == 1)
+    intr_start = start;
+
+#if KZ_CPU_NUM > 1
+  /*
+   * プロセッサ間割込み．要因の処理は短いので割込み禁止のまま行う．
+   * 再スケジューリングは thread_intr() の終了時に行われる．
+   */
+  if (ipi_raised()) {
+    ipi_receive();
+    return;
+  }
+#endif
+
+  type = intr_irq_enter();
+  if (type < 0) /* 要因が見つからなかった */
+    return;
+
+  prev = latency_irq_start[cpu_id()];
+  latency_irq_start[cpu_id()] = start; /* ハンドラから参照できるようにする */
+
+  /* ハンドラの実行中は，カーネル・ロックを解放しておく */
+  spin_unlock(&kernel_lock);
+  INTR_ENABLE;
+  if (handlers[type])
+    handlers[type]();
+  INTR_DISABLE;
+  spin_lock(&kernel_lock);
+
+  latency_irq_start[cpu_id()] = prev;
+  intr_irq_leave();
+
+  latency_record(LATENCY_IRQ, start);
+}
+
+/*
+ * 割込みの遅延処理の実行．
+ * キューの操作は割込み禁止で行い，処理自体は割込み許可で実行するので，
+ * 実行中に発生した割込みのハンドラが新たに登録することもある．
+ */
+static void defer_proc(void)
+{
+  kz_defer_t func;
+  void *arg;
+
+  while (defer_head != defer_tail) {
+    func = defers[defer_head & (DEFER_NUM - 1)].func;
+    arg  = defers[defer_head & (DEFER_NUM - 1)].arg;
+    defer_head++;
+    spin_unlock(&kernel_lock);
+    INTR_ENABLE;
+    func(arg);
+    INTR_DISABLE;
+    spin_lock(&kernel_lock);
+  }
+}
+
 /* 割込み処理の入口関数 */
-static void thread_intr(softvec_type_t type, unsigned long sp)
+static KZ_HOT void thread_intr(softvec_type_t type, unsigned long sp)
 {
-  /* カレント・スレッドのコンテキストを保存する */
-  current->context.sp = sp;
+  kz_context context;
+
+  spin_lock(&kernel_lock); /* dispatch() で解放される */
+
+  if (intr_nest++) {
+    /*
+     * 割込みハンドラの実行中にネストして発生した割込み．
+     * 割り込まれたのはスレッドではなくハンドラなので，コンテキストは
+     * 一時的に保存しておき，処理後にそのまま戻る．
+     */
+    context.sp = sp;
+  } else {
+    /* カレント・スレッドのコンテキストを保存する */
+    current->context.sp = sp;
+    intr_thread = current;
+
+    /* ディスパッチのたびに，動作していたスレッドのスタックを検査する */
+    thread_check_stack(current, sp);
+  }
 
   /*
    * 割込みごとの処理を実行する．
@@ -527,10 +2535,35 @@ static void thread_intr(softvec_type_t type, unsigned long sp)
    * それ以外の場合は，kz_setintr()によってユーザ登録されたハンドラが
    * 実行される．
    */
-  if (handlers[type])
+  if (type == SOFTVEC_TYPE_IRQ)
+    irq_intr();
+  else if (handlers[type])
     handlers[type]();
 
+  /* 最も外側の割込みならば，スケジューリングの前に遅延処理を実行する */
+  if (intr_nest == 1)
+    defer_proc();
+
+  /*
+   * ネストした割込みならば，割り込まれたハンドラに戻る．
+   * スケジューリングは最も外側の割込みの終了時にまとめて行う．
+   */
+  if (--intr_nest) {
+    ipi_flush();
+    dispatch(&context);
+  }
+
   schedule(); /* スレッドのスケジューリング */
+  vfp_switch();
+
+  if (telemetry_traced(TELEMETRY_TRACE_SWITCH) && (current != intr_thread))
+    telemetry_trace(TELEMETRY_TRACE_SWITCH, THREAD_ID(current));
+
+  if (type == SOFTVEC_TYPE_IRQ)
+    latency_record(LATENCY_DISPATCH, intr_start);
+
+  /* 他のコアへの再スケジューリングなどの要求を送信する */
+  ipi_flush();
 
   /*
    * スレッドのディスパッチ
@@ -543,26 +2576,54 @@ static void thread_intr(softvec_type_t type, unsigned long sp)
 void kz_start(kz_func_t func, char *name, int priority, int stacksize,
 	      int argc, char *argv[])
 {
-  kzmem_init(); /* 動的メモリの初期化 */
+  int i;
 
   /*
-   * 以降で呼び出すスレッド関連のライブラリ関数の内部で current を
-   * 見ている場合があるので，current を NULL に初期化しておく．
+   * カーネルのテーブルはすべて静的変数で，startup.S でBSSをクリア
+   * 済みなので，ゼロ以外の初期値を持つものだけを設定する．
+   * (current も NULL になっている．以降で呼び出すスレッド関連の
+   * ライブラリ関数の内部で current を見ている場合がある)
+   * 動的メモリのプールは，最初の獲得時に初期化される．
    */
-  current = NULL;
+  spin_lock(&kernel_lock); /* 最初のスレッドの dispatch() で解放される */
 
-  memset(readyque, 0, sizeof(readyque));
-  memset(threads,  0, sizeof(threads));
-  memset(handlers, 0, sizeof(handlers));
-  memset(msgboxes, 0, sizeof(msgboxes));
+  /* すべてのTCBを未使用リストに繋ぐ */
+  for (i = THREAD_NUM - 1; i >= 0; i--) {
+    threads[i].next = freethreads;
+    freethreads = &threads[i];
+  }
+
+  /* 静的に割り当てられたメッセージ・ボックスは常に利用可能 */
+  for (i = 0; i < MSGBOX_ID_NUM; i++)
+    msgboxes[i].flags = KZ_MSGBOX_FLAG_USED;
 
   /* 割込みハンドラの登録 */
   thread_setintr(SOFTVEC_TYPE_SYSCALL, syscall_intr); /* システム・コール */
   thread_setintr(SOFTVEC_TYPE_SOFTERR, softerr_intr); /* ダウン要因発生 */
+  softvec_setintr(SOFTVEC_TYPE_IRQ, thread_intr); /* IRQは irq_intr() で処理 */
 
-  /* システム・コール発行不可なので直接関数を呼び出してスレッド作成する */
-  current = (kz_thread *)thread_run(func, name, priority, stacksize,
-				    argc, argv);
+  /* ティック割込みの開始 */
+  handlers[SOFTVEC_TYPE_TIMINTR] = tick_intr;
+  timer_tick_init();
+
+  ipi_init(); /* プロセッサ間割込みの受信開始 */
+
+  /*
+   * システム・コール発行不可なので直接関数を呼び出してスレッド作成する．
+   * (作成したスレッドが current に設定される)
+   */
+  thread_run(func, name, priority, stacksize, argc, argv, KZ_AFFINITY_ANY);
+
+  /*
+   * セカンダリ・コアを起動する．
+   * (カーネル・ロックを獲得したままなので，各コアは最初のスレッドの
+   * ディスパッチまで待たされる)
+   */
+  smp_boot_secondary();
+
+  vfp_switch();
+
+  boot_stamp(BOOT_STAGE_KERNEL);
 
   /* 最初のスレッドを起動 */
   dispatch(&current->context);
@@ -570,25 +2631,95 @@ void kz_start(kz_func_t func, char *name, int priority, int stacksize,
   /* ここには返ってこない */
 }
 
+#if KZ_CPU_NUM > 1
+/*
+ * セカンダリ・コアでのOSの動作開始．
+ * カーネルの初期化は kz_start() で済んでいるので，このコアで動作する
+ * アイドル・スレッドを作成してディスパッチするだけでよい．
+ */
+void kz_start_secondary(kz_func_t func, char *name, int priority,
+			int stacksize)
+{
+  spin_lock(&kernel_lock); /* 最初のスレッドの dispatch() で解放される */
+
+  ipi_init(); /* プロセッサ間割込みの受信開始 */
+
+  /* アイドル・スレッドは，このコアから移動させない */
+  current = NULL;
+  thread_run(func, name, priority, stacksize, 0, NULL, (uint32)1 << cpu_id());
+
+  vfp_switch();
+  dispatch(&current->context);
+
+  /* ここには返ってこない */
+}
+#endif
+
 void kz_sysdown(void)
 {
+  int c;
+
+  /*
+   * 停止後は割込みによる出力が行われないので，残っているログを
+   * 直接書き出してから，停止のメッセージを出力する．
+   */
+  while ((c = klog_getc()) >= 0)
+    putc(c);
   puts("system error!\n");
   while (1)
     ;
 }
 
 /* システム・コール呼び出し用ライブラリ関数 */
-void kz_syscall(kz_syscall_type_t type, kz_syscall_param_t *param)
+KZ_HOT void kz_syscall(kz_syscall_type_t type, kz_syscall_param_t *param)
 {
-  current->syscall.type  = type;
-  current->syscall.param = param;
+  /*
+   * 種別とパラメータは r0, r1 でカーネルに渡す．スレッドの動作中は
+   * 別のコアに移動することがあるので，ここで current のTCBに書き込むと，
+   * cpu_id() を読んだ後に移動した場合に別のコアのスレッドのTCBを壊す．
+   */
+  register uint32 r0 asm("r0") = (uint32)type;
+  register uint32 r1 asm("r1") = (uint32)param;
+
   // asm volatile ("trapa #0"); /* トラップ割込み発行 */
-  // TODO: ARM対応
-  asm volatile ("svc #0"); /* トラップ割込み発行 */
+  /* トラップ割込み発行 */
+  asm volatile ("svc #0" : : "r" (r0), "r" (r1) : "memory");
+}
+
+/*
+ * 割込みの遅延処理の登録．
+ * 割込みハンドラの内部で時間のかかる処理は，ここで登録して割込みの
+ * 終了時に実行する．キューが一杯の場合は-1を返す．
+ */
+int kx_defer(kz_defer_t func, void *arg)
+{
+  uint32 cpsr;
+  int ret = -1;
+
+  INTR_SAVE(cpsr);
+  if (defer_tail - defer_head < DEFER_NUM) {
+    defers[defer_tail & (DEFER_NUM - 1)].func = func;
+    defers[defer_tail & (DEFER_NUM - 1)].arg  = arg;
+    defer_tail++;
+    ret = 0;
+  }
+  INTR_RESTORE(cpsr);
+
+  return ret;
 }
 
 /* サービス・コール呼び出し用ライブラリ関数 */
 void kz_srvcall(kz_syscall_type_t type, kz_syscall_param_t *param)
 {
+  uint32 cpsr;
+
+  /*
+   * 割込みハンドラは割込み許可で動作しており，優先度の高い割込みの
+   * ハンドラからもサービス・コールが呼ばれるので，処理中は割込み禁止にする．
+   */
+  INTR_SAVE(cpsr);
+  spin_lock(&kernel_lock);
   srvcall_proc(type, param);
+  spin_unlock(&kernel_lock);
+  INTR_RESTORE(cpsr);
 }
@@ -8,6 +8,9 @@
 /* システム・コール */
 kz_thread_id_t kz_run(kz_func_t func, char *name, int priority, int stacksize,
 		      int argc, char *argv[]);
+kz_thread_id_t kz_run_affinity(kz_func_t func, char *name, int priority,
+			       int stacksize, int argc, char *argv[],
+			       uint32 affinity);
 void kz_exit(void);
 int kz_wait(void);
 int kz_sleep(void);
@@ -17,18 +20,51 @@ int kz_chpri(int priority);
 void *kz_kmalloc(int size);
 int kz_kmfree(void *p);
 int kz_send(kz_msgbox_id_t id, int size, char *p);
+int kz_send_pri(kz_msgbox_id_t id, int priority, int size, char *p);
 kz_thread_id_t kz_recv(kz_msgbox_id_t id, int *sizep, char **pp);
+int kz_sendv(kz_msgbox_id_t id, kz_msgvec_t *vec, int num);
+int kz_recvv(kz_msgbox_id_t id, kz_msgvec_t *vec, int num);
+int kz_call(kz_msgbox_id_t id, int size, char *p, int *rsizep, char **rpp);
+int kz_reply(kz_thread_id_t id, int size, char *p);
+int kz_select(kz_msgbox_id_t *ids, int num, uint32 *readyp);
+int kz_poll(kz_msgbox_id_t *ids, int num, uint32 *readyp);
+int kz_threadinfo(int index, kz_threadinfo_t *info);
+int kz_edf(uint32 period, uint32 budget, uint32 deadline);
+int kz_edf_wait(void);
+int kz_ipi(uint32 cpumask, uint32 reasons);
 int kz_setintr(softvec_type_t type, kz_handler_t handler);
+kz_sem_id_t kz_sem_create(int count);
+int kz_sem_wait(kz_sem_id_t id);
+int kz_sem_post(kz_sem_id_t id);
+kz_mutex_id_t kz_mutex_create(void);
+int kz_mutex_lock(kz_mutex_id_t id);
+int kz_mutex_unlock(kz_mutex_id_t id);
+kz_flag_id_t kz_flag_create(uint32 pattern);
+uint32 kz_flag_wait(kz_flag_id_t id, uint32 pattern, int mode);
+int kz_flag_set(kz_flag_id_t id, uint32 pattern);
+int kz_flag_clear(kz_flag_id_t id, uint32 pattern);
+kz_msgbox_id_t kz_msgbox_create(int attr);
+int kz_msgbox_destroy(kz_msgbox_id_t id);
+kz_ring_id_t kz_ring_create(int slotsize, int slotnum);
+void *kz_ring_reserve(kz_ring_id_t id);
+int kz_ring_commit(kz_ring_id_t id);
+void *kz_ring_peek(kz_ring_id_t id);
+int kz_ring_release(kz_ring_id_t id);
 
 /* サービス・コール */
 int kx_wakeup(kz_thread_id_t id);
 void *kx_kmalloc(int size);
 int kx_kmfree(void *p);
 int kx_send(kz_msgbox_id_t id, int size, char *p);
+int kx_sem_post(kz_sem_id_t id);
+int kx_flag_set(kz_flag_id_t id, uint32 pattern);
+int kx_defer(kz_defer_t func, void *arg);
 
 /* ライブラリ関数 */
 void kz_start(kz_func_t func, char *name, int priority, int stacksize,
 	      int argc, char *argv[]);
+void kz_start_secondary(kz_func_t func, char *name, int priority,
+			int stacksize);
 void kz_sysdown(void);
 void kz_syscall(kz_syscall_type_t type, kz_syscall_param_t *param);
 void kz_srvcall(kz_syscall_type_t type, kz_syscall_param_t *param);
@@ -0,0 +1,125 @@
+#ifndef _KOZOS_CONFIG_H_INCLUDED_
+#define _KOZOS_CONFIG_H_INCLUDED_
+
+/*
+ * カーネルの構成．
+ * 静的に確保するテーブルの大きさはすべてここで定義する．
+ * いずれもコンパイル時に -DTHREAD_NUM=32 のように指定して変更できるので，
+ * 製品ごとのメモリ使用量の調整にソースの編集は不要．
+ * (値の妥当性は，各テーブルを定義しているソースで静的に検査している)
+ */
+
+/*
+ * TCBの個数．
+ * スレッドIDの下位8ビットにTCBのインデックスを入れるので，255個まで．
+ */
+#ifndef THREAD_NUM
+#define THREAD_NUM 16
+#endif
+
+/* 優先度の段数(レディー・キューのビットマップが32ビットなので，32段まで) */
+#ifndef PRIORITY_NUM
+#define PRIORITY_NUM 16
+#endif
+
+/* スレッド名の最大長 */
+#ifndef THREAD_NAME_SIZE
+#define THREAD_NAME_SIZE 15
+#endif
+
+/* カーネル・オブジェクトの個数(メッセージ・ボックスは静的なものも含めた総数) */
+#ifndef MSGBOX_NUM
+#define MSGBOX_NUM 8
+#endif
+#ifndef RING_NUM
+#define RING_NUM 4
+#endif
+#ifndef RING_SIZE_MAX
+#define RING_SIZE_MAX 0x8000 /* リングのスロットのサイズと個数の上限 */
+#endif
+#ifndef SEM_NUM
+#define SEM_NUM 8
+#endif
+#ifndef MUTEX_NUM
+#define MUTEX_NUM 8
+#endif
+#ifndef FLAG_NUM
+#define FLAG_NUM 4
+#endif
+
+/* 割込みの遅延処理の最大数(2の累乗) */
+#ifndef DEFER_NUM
+#define DEFER_NUM 16
+#endif
+
+/*
+ * 動的メモリのプール(ブロックのサイズと個数)．
+ * サイズは2の累乗で，小さい順に並べること．
+ */
+#ifndef KZMEM_POOLS
+#define KZMEM_POOLS(X) \
+  X(16, 8) \
+  X(32, 8) \
+  X(64, 8) \
+  X(128, 4)
+#endif
+
+/*
+ * スレッドのスタックのサイズ・クラス(2の累乗で，小さい順に並べること)．
+ * システム・コールや割込みの処理も割り込まれたスレッドのスタック上で
+ * 動作し，コンテキストの退避と kprintf() などで200バイト以上を使うので，
+ * 最小のクラスは0x200とする．
+ */
+#ifndef KZMEM_STACKPOOLS
+#define KZMEM_STACKPOOLS(X) \
+  X(0x200) \
+  X(0x400) \
+  X(0x800) \
+  X(0x1000)
+#endif
+
+/* コンソール・ドライバ */
+#ifndef CONSDRV_DEVICE_NUM
+#define CONSDRV_DEVICE_NUM 1
+#endif
+/*
+ * コンソールのボーレート(serial.c の表にあるもの)．テレメトリを数KB/sで
+ * 出力できるように 115200 とする．変更した場合は，tools/ のホスト側の
+ * ツールにも -b などで同じ値を指定すること．
+ */
+#ifndef SERIAL_DEFAULT_BAUD
+#define SERIAL_DEFAULT_BAUD 115200
+#endif
+#ifndef CONS_SEND_SIZE /* 送信バッファ(2の累乗) */
+#define CONS_SEND_SIZE 256
+#endif
+#ifndef CONS_LINE_SIZE /* １行の最大長(終端を含む) */
+#define CONS_LINE_SIZE 64
+#endif
+#ifndef CONS_HISTORY_NUM /* 行の履歴の数(2の累乗) */
+#define CONS_HISTORY_NUM 4
+#endif
+
+/* カーネルのログ(リング・バッファはコアごとで，大きさは2の累乗) */
+#ifndef KLOG_BUF_SIZE
+#define KLOG_BUF_SIZE 512
+#endif
+#ifndef KLOG_LINE_SIZE /* １回の kprintf() で出力できる最大長 */
+#define KLOG_LINE_SIZE 80
+#endif
+#ifndef KLOG_LEVEL /* 起動時に出力するレベル */
+#define KLOG_LEVEL KLOG_INFO
+#endif
+#ifndef KLOG_RATELIMIT_USEC /* 頻度制限の期間(us) */
+#define KLOG_RATELIMIT_USEC 1000000
+#endif
+#ifndef KLOG_RATELIMIT_BURST /* 頻度制限の期間内に出力できる数 */
+#define KLOG_RATELIMIT_BURST 5
+#endif
+
+/* テレメトリの１フレームのデータの最大長 */
+#ifndef TELEMETRY_DATA_SIZE
+#define TELEMETRY_DATA_SIZE 64
+#endif
+
+#endif
@@ -0,0 +1,73 @@
+#include "defines.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "lib.h"
+#include "smp.h"
+#include "latency.h"
+
+volatile uint32 latency_irq_entry[KZ_CPU_NUM];
+uint32 latency_irq_start[KZ_CPU_NUM];
+uint32 latency_recv_start;
+
+/* ヒストグラムはコアごとに持ち，取得時に合算する */
+static latency_hist_t latency_hists[KZ_CPU_NUM][LATENCY_NUM];
+
+/*
+ * start からの経過時間をヒストグラムに記録する．
+ * 割込みハンドラからも呼ばれるので，割込み禁止で自コアのものを更新する．
+ */
+void latency_record(int type, uint32 start)
+{
+  latency_hist_t *hist = &latency_hists[cpu_id()][type];
+  uint32 t, cpsr;
+  int bin;
+
+  t = timer_get() - start;
+
+  /* 区間は経過時間の2進の桁数(割算を使わずに求める) */
+  bin = t ? (32 - __builtin_clz(t)) : 0;
+  if (bin >= LATENCY_BIN_NUM)
+    bin = LATENCY_BIN_NUM - 1;
+
+  INTR_SAVE(cpsr);
+  hist->bins[bin]++;
+  hist->count++;
+  if (hist->max < t)
+    hist->max = t;
+  INTR_RESTORE(cpsr);
+}
+
+/* ヒストグラムの取得 */
+int latency_get(int type, latency_hist_t *hist)
+{
+  latency_hist_t *h;
+  uint32 cpsr;
+  int i, j;
+
+  if ((type < 0) || (type >= LATENCY_NUM))
+    return -1;
+
+  memset(hist, 0, sizeof(*hist));
+  INTR_SAVE(cpsr);
+  for (i = 0; i < KZ_CPU_NUM; i++) {
+    h = &latency_hists[i][type];
+    for (j = 0; j < LATENCY_BIN_NUM; j++)
+      hist->bins[j] += h->bins[j];
+    hist->count += h->count;
+    if (hist->max < h->max)
+      hist->max = h->max;
+  }
+  INTR_RESTORE(cpsr);
+
+  return 0;
+}
+
+/* ヒストグラムのクリア */
+void latency_reset(void)
+{
+  uint32 cpsr;
+
+  INTR_SAVE(cpsr);
+  memset(latency_hists, 0, sizeof(latency_hists));
+  INTR_RESTORE(cpsr);
+}
@@ -0,0 +1,32 @@
+#ifndef _LATENCY_H_INCLUDED_
+#define _LATENCY_H_INCLUDED_
+
+/* 計測する区間(IPI以外は IRQ_Handler_asm の入口からの経過時間) */
+#define LATENCY_IRQ      0 /* IRQハンドラの終了まで */
+#define LATENCY_DISPATCH 1 /* スレッドのディスパッチまで */
+#define LATENCY_RECV     2 /* 受信した行の kz_recv() からの復帰まで */
+#define LATENCY_IPI      3 /* IPIの送信から受信側での処理まで */
+#define LATENCY_NUM      4
+
+/*
+ * ヒストグラムの区間数．区間0は0us，区間iは 2^(i-1)〜2^i-1 us で，
+ * 最後の区間にはそれ以上をすべて含める．
+ */
+#define LATENCY_BIN_NUM  16
+
+typedef struct {
+  uint32 bins[LATENCY_BIN_NUM];
+  uint32 count; /* 計測回数 */
+  uint32 max;   /* 最大値(us) */
+} latency_hist_t;
+
+/* 割込みの時刻はコアごとに持つ(配列の要素数は KZ_CPU_NUM) */
+extern volatile uint32 latency_irq_entry[]; /* IRQ_Handler_asm の入口の時刻 */
+extern uint32 latency_irq_start[];  /* 実行中のIRQハンドラの割込み発生時刻 */
+extern uint32 latency_recv_start; /* 受信した行の割込み発生時刻 */
+
+void latency_record(int type, uint32 start); /* 経過時間を記録 */
+int latency_get(int type, latency_hist_t *hist); /* ヒストグラムの取得 */
+void latency_reset(void); /* ヒストグラムのクリア */
+
+#endif
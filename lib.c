@@ -2,10 +2,25 @@
 #include "serial.h"
 #include "lib.h"
 
+/*
+ * memset()/memcpy() は，4バイト境界に揃う部分をワード単位で処理する．
+ * (先頭と末尾の端数はバイト単位)
+ */
 void *memset(void *b, int c, long len)
 {
-  char *p;
-  for (p = b; len > 0; len--)
+  char *p = b;
+  uint32 *wp, w;
+
+  for (; (len > 0) && ((uint32)p & 3); len--)
+    *(p++) = c;
+
+  w = (uint8)c;
+  w |= w << 8;
+  w |= w << 16;
+  for (wp = (uint32 *)p; len >= 4; len -= 4)
+    *(wp++) = w;
+
+  for (p = (char *)wp; len > 0; len--)
     *(p++) = c;
   return b;
 }
@@ -14,6 +29,21 @@ void *memcpy(void *dst, const void *src, long len)
 {
   char *d = dst;
   const char *s = src;
+  uint32 *wd;
+  const uint32 *ws;
+
+  /* 転送元と転送先の境界がずれている場合は，すべてバイト単位 */
+  if (!(((uint32)d ^ (uint32)s) & 3)) {
+    for (; (len > 0) && ((uint32)d & 3); len--)
+      *(d++) = *(s++);
+    wd = (uint32 *)d;
+    ws = (const uint32 *)s;
+    for (; len >= 4; len -= 4)
+      *(wd++) = *(ws++);
+    d = (char *)wd;
+    s = (const char *)ws;
+  }
+
   for (; len > 0; len--)
     *(d++) = *(s++);
   return dst;
@@ -72,11 +102,31 @@ int strncmp(const char *s1, const char *s2, int len)
   return 0;
 }
 
+/*
+ * CRC-16/XMODEM(CRC-CCITT，多項式0x1021，初期値は crc で与える)．
+ * 続けて計算する場合は，前回の結果を crc に渡す．
+ */
+uint16 crc16(uint16 crc, const void *p, int len)
+{
+  const unsigned char *s = p;
+  int i;
+
+  for (; len > 0; len--) {
+    crc ^= (uint16)*(s++) << 8;
+    for (i = 0; i < 8; i++)
+      crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+  }
+  return crc;
+}
+
 /* １文字送信 */
 int putc(unsigned char c)
 {
   if (c == '\n')
-    serial_send_byte(SERIAL_DEFAULT_DEVICE, '\r');
+    putc('\r');
+  /* 送信FIFOが一杯ならば空くまで待つ(書き込んだ文字が捨てられないように) */
+  while (!serial_is_send_enable(SERIAL_DEFAULT_DEVICE))
+    ;
   return serial_send_byte(SERIAL_DEFAULT_DEVICE, c);
 }
 
@@ -111,13 +161,14 @@ int gets(unsigned char *buf)
   return i - 1;
 }
 
-/* 数値の16進表示 */
-int putxval(unsigned long value, int column)
+/* 数値の16進文字列への変換(終端の'\0'を除いた文字数を返す) */
+int sputxval(char *buf, unsigned long value, int column)
 {
-  char buf[9];
+  char tmp[9];
   char *p;
+  int len;
 
-  p = buf + sizeof(buf) - 1;
+  p = tmp + sizeof(tmp) - 1;
   *(p--) = '\0';
 
   if (!value && !column)
@@ -129,7 +180,19 @@ int putxval(unsigned long value, int column)
     if (column) column--;
   }
 
-  puts(p + 1);
+  len = tmp + sizeof(tmp) - 2 - p;
+  strcpy(buf, p + 1);
+
+  return len;
+}
+
+/* 数値の16進表示 */
+int putxval(unsigned long value, int column)
+{
+  char buf[9];
+
+  sputxval(buf, value, column);
+  puts((unsigned char *)buf);
 
   return 0;
 }
@@ -8,11 +8,13 @@ int strlen(const char *s);
 char *strcpy(char *dst, const char *src);
 int strcmp(const char *s1, const char *s2);
 int strncmp(const char *s1, const char *s2, int len);
+uint16 crc16(uint16 crc, const void *p, int len); /* CRC-16/XMODEM */
 
 int putc(unsigned char c);    /* １文字送信 */
 unsigned char getc(void);     /* １文字受信 */
 int puts(unsigned char *str); /* 文字列送信 */
 int gets(unsigned char *buf); /* 文字列受信 */
 int putxval(unsigned long value, int column); /* 数値の16進表示 */
+int sputxval(char *buf, unsigned long value, int column); /* 16進文字列変換 */
 
 #endif
@@ -0,0 +1,183 @@
+#include "defines.h"
+#include "kozos.h"
+#include "serial.h"
+#include "timer.h"
+#include "interrupt.h"
+#include "smp.h"
+#include "lib.h"
+#include "loader.h"
+
+#define XMODEM_SOH 0x01 /* 128バイトのブロック */
+#define XMODEM_STX 0x02 /* 1024バイトのブロック(XMODEM-1K) */
+#define XMODEM_EOT 0x04 /* 送信終了 */
+#define XMODEM_ACK 0x06
+#define XMODEM_NAK 0x15
+#define XMODEM_CAN 0x18 /* 中断 */
+#define XMODEM_CRC 'C'  /* CRCモードでの送信開始の要求 */
+
+#define XMODEM_TIMEOUT     1000000 /* 1文字の受信待ち時間(us) */
+#define XMODEM_START_RETRY 60      /* 送信開始を待つ回数(1秒ごと) */
+#define XMODEM_RETRY       10      /* 同じブロックの再送を要求する回数 */
+
+extern char _loadarea_size; /* リンカ・スクリプトで定義される */
+
+static int loader_index; /* 受信に使うシリアルの番号 */
+
+/* 1文字受信．timeout(us)以内に受信しなければ-1を返す */
+static int recv_byte(uint32 timeout)
+{
+  uint32 start = timer_get();
+
+  while (!serial_is_recv_enable(loader_index)) {
+    if (timer_get() - start >= timeout)
+      return -1;
+  }
+  return serial_recv_byte(loader_index);
+}
+
+/* 1文字送信(送信FIFOが空くまで待つ) */
+static void send_byte(unsigned char c)
+{
+  while (!serial_is_send_enable(loader_index))
+    ;
+  serial_send_byte(loader_index, c);
+}
+
+/* 送信側が止まるまで，受信データを読み捨てる */
+static void purge(void)
+{
+  while (recv_byte(XMODEM_TIMEOUT) >= 0)
+    ;
+}
+
+/* 受信の中断 */
+static void cancel(void)
+{
+  send_byte(XMODEM_CAN);
+  send_byte(XMODEM_CAN);
+  purge();
+}
+
+/*
+ * XMODEM(CRCモード，128/1024バイトのブロック)での受信．
+ * データは buf に直接書き込み，受信したサイズを返す．
+ */
+static int xmodem_receive(char *buf, int size)
+{
+  int c, i, len, retry = 0, total = 0, started = 0;
+  unsigned char blk = 1, hdr[2], crc[2], response = XMODEM_CRC;
+
+  while (1) {
+    send_byte(response);
+
+    c = recv_byte(XMODEM_TIMEOUT);
+    switch (c) {
+    case XMODEM_SOH:
+      len = 128;
+      break;
+    case XMODEM_STX:
+      len = 1024;
+      break;
+    case XMODEM_EOT:
+      send_byte(XMODEM_ACK);
+      return total;
+    case XMODEM_CAN:
+      return -1;
+    default: /* タイムアウトか不正な文字 */
+      if (c >= 0)
+	purge();
+      if (started)
+	response = XMODEM_NAK;
+      if (++retry >= (started ? XMODEM_RETRY : XMODEM_START_RETRY)) {
+	cancel();
+	return -1;
+      }
+      continue;
+    }
+
+    if (total + len > size) { /* 領域があふれる */
+      cancel();
+      return -1;
+    }
+
+    /* ブロック番号とその補数，データ，CRC(上位が先)を受信する */
+    for (i = 0; i < 2; i++) {
+      if ((c = recv_byte(XMODEM_TIMEOUT)) < 0)
+	break;
+      hdr[i] = c;
+    }
+    for (; (i >= 2) && (i < len + 2); i++) {
+      if ((c = recv_byte(XMODEM_TIMEOUT)) < 0)
+	break;
+      buf[total + i - 2] = c;
+    }
+    for (; (i >= len + 2) && (i < len + 4); i++) {
+      if ((c = recv_byte(XMODEM_TIMEOUT)) < 0)
+	break;
+      crc[i - len - 2] = c;
+    }
+
+    if ((i < len + 4) || ((hdr[0] ^ hdr[1]) != 0xff) ||
+	(crc16(0, &buf[total], len) != ((crc[0] << 8) | crc[1]))) {
+      /* 壊れたブロックは再送を要求する */
+      purge();
+      response = XMODEM_NAK;
+      if (++retry >= XMODEM_RETRY) {
+	cancel();
+	return -1;
+      }
+      continue;
+    }
+
+    started = 1;
+    retry = 0;
+    response = XMODEM_ACK;
+    if (hdr[0] == blk) {
+      total += len;
+      blk++;
+    } else if (hdr[0] != (unsigned char)(blk - 1)) {
+      /* 前回のブロックの再送(ACKの消失)以外は，同期が外れている */
+      cancel();
+      return -1;
+    }
+  }
+}
+
+/*
+ * 他のコアも含めて，命令キャッシュと分岐予測を無効にする．
+ * (データ・キャッシュは有効にしていないので，書き込んだ内容はそのまま
+ * 命令フェッチから見える．動作中のコアの操作はARMv6/v7共通のCP15操作)
+ * 途中で別のコアに移動すると無効にしないコアが残るので，kz_ipi() の
+ * 発行までは割込み禁止で行う．(割込み禁止のままシステム・コールを呼べる)
+ */
+static void loader_sync_icache(void)
+{
+  uint32 cpsr;
+
+  INTR_SAVE(cpsr);
+  asm volatile ("mcr p15, 0, %0, c7, c5, 0" : : "r" (0) : "memory");
+  asm volatile ("mcr p15, 0, %0, c7, c5, 6" : : "r" (0) : "memory");
+  asm volatile ("mcr p15, 0, %0, c7, c5, 4" : : "r" (0) : "memory");
+  kz_ipi(KZ_AFFINITY_ANY & ~((uint32)1 << cpu_id()), IPI_ICACHE_FLUSH);
+  INTR_RESTORE(cpsr);
+}
+
+int loader_receive(int index, int baud)
+{
+  int size;
+
+  loader_index = index;
+  if (serial_set_baud(index, baud) < 0)
+    return -1;
+
+  size = xmodem_receive(LOADER_ADDR, (int)&_loadarea_size);
+
+  /* ホスト側がボーレートを戻す間に，受信データが残らないように待つ */
+  purge();
+  serial_set_baud(index, SERIAL_DEFAULT_BAUD);
+
+  if (size > 0)
+    loader_sync_icache();
+
+  return size;
+}
@@ -0,0 +1,30 @@
+#ifndef _LOADER_H_INCLUDED_
+#define _LOADER_H_INCLUDED_
+
+/*
+ * シリアル・ローダ．
+ * XMODEM-1K(CRCモード)でアプリケーションのイメージを受信し，
+ * ld.scr の loadarea(0x10000000〜)に書き込む．
+ *
+ * イメージはこのアドレスにリンクした生のバイナリで，先頭にARM命令の
+ * スレッド関数(int func(int argc, char *argv[]))を置く．カーネルの
+ * ライブラリ関数はカーネルのシンボルを参照してリンクすればよい．
+ *   arm-none-eabi-gcc -nostdlib -Wl,-Ttext=0x10000000 \
+ *     -Wl,--just-symbols=kozos.elf -o app.elf app.c
+ *   arm-none-eabi-objcopy -O binary app.elf app.bin
+ * 送信側は tools/xmodem_send.py を使う．
+ */
+#define LOADER_BAUD 115200 /* 受信中のボーレート */
+
+extern char _loadarea;
+#define LOADER_ADDR (&_loadarea)
+
+/*
+ * シリアル index からイメージを受信する．
+ * 受信中はボーレートを baud に変更し，終了後に元に戻す．
+ * 受信したサイズ(128バイト単位に切り上げ)を返す．失敗した場合は-1．
+ * (呼び出し前にコンソール・ドライバからシリアルを占有しておくこと)
+ */
+int loader_receive(int index, int baud);
+
+#endif
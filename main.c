@@ -2,10 +2,17 @@
 #include "kozos.h"
 #include "interrupt.h"
 #include "lib.h"
+#include "smp.h"
+#include "timer.h"
+#include "boot.h"
+
+uint32 boot_stamps[BOOT_STAGE_NUM]; /* 起動処理の各段階の時刻 */
 
 /* システム・タスクとユーザ・タスクの起動 */
 static int start_threads(int argc, char *argv[])
 {
+  boot_stamp(BOOT_STAGE_THREAD);
+
   kz_run(consdrv_main, "consdrv",  1, 0x200, 0, NULL);
   kz_run(command_main, "command",  8, 0x200, 0, NULL);
 
@@ -18,11 +25,39 @@ static int start_threads(int argc, char *argv[])
   return 0;
 }
 
+#if KZ_CPU_NUM > 1
+/*
+ * セカンダリ・コアのアイドル・スレッド．
+ * 他のコアのカーネル処理が終わる(SEVが発行される)まで省電力で待ち，
+ * このコアのスレッドが起床されていれば切り替わる．
+ * (他のコアから起床された場合はプロセッサ間割込みで直接切り替わる)
+ */
+static int idle_secondary(int argc, char *argv[])
+{
+  while (1) {
+    asm volatile ("wfe");
+    kz_wait();
+  }
+
+  return 0;
+}
+
+/* セカンダリ・コアの起動(startup.S の _start_secondary から呼ばれる) */
+void main_secondary(void)
+{
+  kz_start_secondary(idle_secondary, "idle", 15, 0x100);
+  /* ここには戻ってこない */
+}
+#endif
+
 int main(void)
 {
   INTR_DISABLE; /* 割込み無効にする */
 
-  puts("kozos boot succeed!\n");
+  /*
+   * 起動メッセージはコマンド・スレッドがコンソール・ドライバ経由で出力する．
+   * (ここでシリアルに直接出力すると，出力の完了まで起動が遅れる)
+   */
 
   /* OSの動作開始 */
   kz_start(start_threads, "idle", 0, 0x100, 0, NULL);
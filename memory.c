@@ -1,7 +1,9 @@
 #include "defines.h"
 #include "kozos.h"
+#include "smp.h"
 #include "lib.h"
 #include "memory.h"
+#include "shell.h"
 
 /*
  * メモリ・ブロック構造体
@@ -17,23 +19,45 @@ typedef struct _kzmem_pool {
   int size;
   int num;
   kzmem_block *free;
+  int count; /* ブロックの総数 */
+  int used;  /* 獲得中のブロック数 */
+  int peak;  /* 獲得中のブロック数の最大 */
 } kzmem_pool;
 
-/* メモリ・プールの定義(個々のサイズと個数) */
+/* メモリ・プールの定義(個々のサイズと個数は kozos_config.h で定義する) */
+#define KZMEM_POOL_ENTRY(size, num) { size, num, NULL, num, 0, 0 },
 static kzmem_pool pool[] = {
-  { 16, 8, NULL }, { 32, 8, NULL }, { 64, 4, NULL },
+  KZMEM_POOLS(KZMEM_POOL_ENTRY)
 };
 
+#define KZMEM_POOL_CHECK(size, num) \
+  KZ_STATIC_ASSERT(KZ_IS_POW2(size) && (size > sizeof(kzmem_block)), \
+		   "memory pool size must be a power of 2");
+KZMEM_POOLS(KZMEM_POOL_CHECK)
+
 #define MEMORY_AREA_NUM (sizeof(pool) / sizeof(*pool))
 
-/* メモリ・プールの初期化 */
+extern char _freearea; /* リンカ・スクリプトで定義される空き領域 */
+extern char _loadarea; /* 空き領域の直後にあるロード領域 */
+static char *area = &_freearea; /* 空き領域の未使用部分の先頭 */
+
+/*
+ * メモリ・プールの初期化．
+ * 起動時間を短くするため，起動時にはまとめて行わず，プールごとに
+ * 最初の獲得時に空き領域から切り出す．(初期化後は num をゼロにする)
+ * プールの設定が空き領域(ロード領域の手前まで)に収まらなければ，
+ * ロード領域を壊さないようにシステムを停止する．
+ */
 static int kzmem_init_pool(kzmem_pool *p)
 {
   int i;
   kzmem_block *mp;
   kzmem_block **mpp;
-  extern char _freearea; /* リンカ・スクリプトで定義される空き領域 */
-  static char *area = &_freearea;
+
+  if (p->size * p->num > &_loadarea - area) {
+    kz_sysdown();
+    return -1;
+  }
 
   mp = (kzmem_block *)area;
 
@@ -47,22 +71,13 @@ static int kzmem_init_pool(kzmem_pool *p)
     mp = (kzmem_block *)((char *)mp + p->size);
     area += p->size;
   }
+  p->num = 0;
 
   return 0;
 }
 
-/* 動的メモリの初期化 */
-int kzmem_init(void)
-{
-  int i;
-  for (i = 0; i < MEMORY_AREA_NUM; i++) {
-    kzmem_init_pool(&pool[i]); /* 各メモリ・プールを初期化する */
-  }
-  return 0;
-}
-
 /* 動的メモリの獲得 */
-void *kzmem_alloc(int size)
+KZ_HOT void *kzmem_alloc(int size)
 {
   int i;
   kzmem_block *mp;
@@ -71,6 +86,8 @@ void *kzmem_alloc(int size)
   for (i = 0; i < MEMORY_AREA_NUM; i++) {
     p = &pool[i];
     if (size <= p->size - sizeof(kzmem_block)) {
+      if ((p->free == NULL) && p->num) /* 最初の獲得 */
+	kzmem_init_pool(p);
       if (p->free == NULL) { /* 解放済み領域が無い(メモリ・ブロック不足) */
 	kz_sysdown();
 	return NULL;
@@ -79,6 +96,8 @@ void *kzmem_alloc(int size)
       mp = p->free;
       p->free = p->free->next;
       mp->next = NULL;
+      if (++p->used > p->peak)
+	p->peak = p->used;
 
       /*
        * 実際に利用可能な領域は，メモリ・ブロック構造体の直後の領域に
@@ -94,7 +113,7 @@ void *kzmem_alloc(int size)
 }
 
 /* メモリの解放 */
-void kzmem_free(void *mem)
+KZ_HOT void kzmem_free(void *mem)
 {
   int i;
   kzmem_block *mp;
@@ -109,9 +128,155 @@ void kzmem_free(void *mem)
       /* 領域を解放済みリンクリストに戻す */
       mp->next = p->free;
       p->free = mp;
+      p->used--;
       return;
     }
   }
 
   kz_sysdown();
 }
+
+/*
+ * 固定領域の獲得．
+ * メモリ・プールに収まらない大きさの領域を空き領域から切り出す．
+ * 獲得した領域は解放できないので，生成時に一度だけ獲得するような
+ * 用途(リング・チャネルのバッファなど)に利用すること．
+ * 空き領域(ロード領域の手前まで)に収まらない場合は NULL を返す．
+ */
+void *kzmem_alloc_static(int size)
+{
+  char *p;
+
+  if (size <= 0)
+    return NULL;
+  size = (size + 7) & ~7; /* 8バイト境界に揃える */
+  if (size > &_loadarea - area)
+    return NULL;
+
+  p = area;
+  area += size;
+  memset(p, 0, size);
+
+  return p;
+}
+
+/*
+ * スタック・プール．
+ * スレッドのスタックはサイズ・クラスごとに管理し，スレッド終了時に
+ * 解放済みリストに戻して再利用する．解放済みのスタックが無い場合は
+ * スタック領域から新たに切り出す．
+ * (解放済みリストのリンクは，スタックの最下位アドレスに置く)
+ */
+typedef struct _kzmem_stack {
+  struct _kzmem_stack *next;
+} kzmem_stack;
+
+typedef struct _kzmem_stackpool {
+  int size;
+  kzmem_stack *free;
+} kzmem_stackpool;
+
+#define KZMEM_STACKPOOL_ENTRY(size) { size, NULL },
+static kzmem_stackpool stackpool[] = {
+  KZMEM_STACKPOOLS(KZMEM_STACKPOOL_ENTRY)
+};
+
+#define KZMEM_STACKPOOL_CHECK(size) \
+  KZ_STATIC_ASSERT(KZ_IS_POW2(size), "stack size class must be a power of 2");
+KZMEM_STACKPOOLS(KZMEM_STACKPOOL_CHECK)
+
+#define STACKPOOL_NUM (sizeof(stackpool) / sizeof(*stackpool))
+
+extern char _userstack; /* リンカ・スクリプトで定義されるスタック領域 */
+static char *stackarea = &_userstack; /* スタック領域の未使用部分の先頭 */
+
+/* スタック領域の上限(ここから上にはコアごとの割込みスタックが並ぶ) */
+extern char _intrstack, _intrstack_size;
+#define STACKAREA_END (&_intrstack - KZ_CPU_NUM * (int)&_intrstack_size)
+
+/*
+ * スタックの獲得．
+ * サイズはサイズ・クラスに切り上げて *sizep に返す．戻り値は
+ * スタック領域の最下位アドレス(スタックの底は +*sizep の位置)．
+ * 最大のサイズ・クラスより大きいものと，スタック領域が不足した場合は
+ * NULL を返す．
+ */
+void *kzmem_stack_alloc(int *sizep)
+{
+  int i;
+  char *p;
+  kzmem_stackpool *sp;
+
+  for (i = 0; i < STACKPOOL_NUM; i++) {
+    sp = &stackpool[i];
+    if (*sizep <= sp->size) {
+      *sizep = sp->size;
+      if (sp->free) { /* 解放済みのスタックを再利用する */
+	p = (char *)sp->free;
+	sp->free = sp->free->next;
+	return p;
+      }
+      break;
+    }
+  }
+  if (i == STACKPOOL_NUM) /* 解放しても再利用できないので獲得させない */
+    return NULL;
+
+  /* 解放済みのものが無いので，スタック領域から切り出す */
+  if (*sizep > STACKAREA_END - stackarea) /* スタック領域が不足 */
+    return NULL;
+  p = stackarea;
+  stackarea += *sizep;
+
+  return p;
+}
+
+/* スタックの解放 */
+void kzmem_stack_free(void *stack, int size)
+{
+  int i;
+  kzmem_stack *mp = stack;
+  kzmem_stackpool *sp;
+
+  for (i = 0; i < STACKPOOL_NUM; i++) {
+    sp = &stackpool[i];
+    if (size == sp->size) {
+      mp->next = sp->free;
+      sp->free = mp;
+      return;
+    }
+  }
+
+  kz_sysdown(); /* サイズ・クラスに無い大きさのものは獲得されていない */
+}
+
+/*
+ * memコマンド(メモリ・プールの使用状況)
+ * プールが不足するとシステムが停止するので，PEAK を見て個数を調整する．
+ * (表示用に参照するだけなので，排他せずに読む)
+ */
+static int mem_command(int argc, char *argv[])
+{
+  int i;
+
+  shell_write("SIZE COUNT USED PEAK\n");
+  for (i = 0; i < MEMORY_AREA_NUM; i++) {
+    shell_xval(pool[i].size, 4);
+    shell_write(" ");
+    shell_xval(pool[i].count, 5);
+    shell_write(" ");
+    shell_xval(pool[i].used, 4);
+    shell_write(" ");
+    shell_xval(pool[i].peak, 4);
+    shell_write("\n");
+  }
+  shell_write("area used: ");
+  shell_xval(area - &_freearea, 0);
+  shell_write(" stack area used: ");
+  shell_xval(stackarea - &_userstack, 0);
+  shell_write("\n");
+
+  return 0;
+}
+
+SHELL_COMMAND(mem, mem_command, "- memory pool usage");
@@ -1,8 +1,10 @@
 #ifndef _KOZOS_MEMORY_H_INCLUDED_
 #define _KOZOS_MEMORY_H_INCLUDED_
 
-int kzmem_init(void);        /* 動的メモリの初期化 */
 void *kzmem_alloc(int size); /* 動的メモリの獲得 */
 void kzmem_free(void *mem);  /* メモリの解放 */
+void *kzmem_alloc_static(int size); /* 固定領域の獲得 */
+void *kzmem_stack_alloc(int *sizep); /* スタックの獲得 */
+void kzmem_stack_free(void *stack, int size); /* スタックの解放 */
 
 #endif
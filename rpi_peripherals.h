@@ -1,7 +1,17 @@
 #ifndef RPILIB_PERIPHERALS_H
 #define RPILIB_PERIPHERALS_H
 
-#define PHY_PERI_ADDR(x) (0x20000000 + (x))
+/*
+ * ペリフェラルの物理アドレス．
+ * BCM2835(Pi 1)とBCM2836/2837(Pi 2/3)ではベース・アドレスが異なる．
+ * (アセンブラからも参照するので，このファイルには#define以外を書かないこと)
+ */
+#ifdef RPI2
+#define PERI_BASE 0x3F000000
+#else
+#define PERI_BASE 0x20000000
+#endif
+#define PHY_PERI_ADDR(x) (PERI_BASE + (x))
 
 // GPIO Peripheral
 #define GPIO_BASE	(0x00200000)
@@ -115,4 +125,16 @@
 #define INTERRUPT_DISABLE_BASIC_IRQS	((volatile uint32 *)PHY_PERI_ADDR(INTERRUPT_BASE + 0x224))
 
 
+// ARM local peripherals (BCM2836/2837 only)
+// コアごとのメールボックス．メールボックス3はセカンダリ・コアの起動に使う
+// メールボックス0はプロセッサ間割込み(IPI)に使う
+#define ARM_LOCAL_BASE		(0x40000000)
+#define CORE_MBOX_INTCTL(n)	((volatile uint32 *)(ARM_LOCAL_BASE + 0x50 + ((n) << 2)))
+#define CORE_IRQ_SOURCE(n)	((volatile uint32 *)(ARM_LOCAL_BASE + 0x60 + ((n) << 2)))
+#define CORE_MBOX_INTCTL_MBOX0	(1 << 0)
+#define CORE_IRQ_SOURCE_MBOX0	(1 << 4)
+#define CORE_MBOX_SET(n, m)	((volatile uint32 *)(ARM_LOCAL_BASE + 0x80 + ((n) << 4) + ((m) << 2)))
+#define CORE_MBOX_RDCLR(n, m)	((volatile uint32 *)(ARM_LOCAL_BASE + 0xC0 + ((n) << 4) + ((m) << 2)))
+
+
 #endif
@@ -1,6 +1,8 @@
 #include "defines.h"
 #include "serial.h"
 #include "rpi_peripherals.h"
+#include "intr.h"
+#include "interrupt.h"
 
 /* デバイス初期化 */
 int serial_init(int index)
@@ -19,25 +21,66 @@ int serial_init(int index)
   // 割り込みフラグのクリア
   *UART0_ICR = 0x7ff;
 
-  // ボーレートの設定(9600)
-  *UART0_IBRD = 19;
-  *UART0_FBRD = 34;
-
   // LCRH
 	// stick parity dis, 8bit, FIFO en, two stop bit no, odd parity, parity dis, break no
 	*UART0_LCRH = 3 << 5;
 
+  // ボーレートの設定(UARTは無効のまま，LCRHの再書き込みで反映される)
+  if (serial_set_baud(index, SERIAL_DEFAULT_BAUD) < 0)
+    return -1;
+
 	// CR
 	// CTS dis, RTS dis, OUT1-2=0, RTS dis, DTR dis, RXE en, TXE en, loop back dis, SIRLP=0, SIREN=0, UARTEN en
 	*UART0_CR 	= 0x0301;
 
   // UART割り込みを有効化
   // UARTのIRQ番号は57
-  *INTERRUPT_ENABLE_IRQS2 = ((uint32)1 << (57 % 32));
+  // 受信のエコー処理などで時間がかかるので，優先度は低めにしておく
+  intr_enable_irq(57, SOFTVEC_TYPE_SERINTR, INTR_PRIORITY_NUM - 1);
 
   return 0;
 }
 
+/*
+ * ボーレートの変更．
+ * UARTのクロック(3MHz)からの分周比は割算を使わないように表で持つ．
+ * (3MHzでは 115200 が上限)
+ */
+static const struct {
+  int baud;
+  uint32 ibrd; /* 整数部 */
+  uint32 fbrd; /* 小数部(1/64単位) */
+} serial_bauds[] = {
+  {   9600, 19, 34 },
+  {  19200,  9, 49 },
+  {  38400,  4, 57 },
+  {  57600,  3, 16 },
+  { 115200,  1, 40 },
+};
+
+int serial_set_baud(int index, int baud)
+{
+  uint32 cr;
+  int i;
+
+  for (i = 0; i < sizeof(serial_bauds) / sizeof(*serial_bauds); i++) {
+    if (serial_bauds[i].baud != baud)
+      continue;
+
+    while (*UART0_FR & (1 << 3)) /* BUSY: 送信中の文字の完了待ち */
+      ;
+    cr = *UART0_CR;
+    *UART0_CR = 0;
+    *UART0_IBRD = serial_bauds[i].ibrd;
+    *UART0_FBRD = serial_bauds[i].fbrd;
+    *UART0_LCRH = *UART0_LCRH; /* 分周比はLCRHの書き込みで反映される */
+    *UART0_CR = cr;
+    return 0;
+  }
+
+  return -1;
+}
+
 /* 送信可能か？ */
 int serial_is_send_enable(int index)
 {
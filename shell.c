@@ -0,0 +1,219 @@
+#include "defines.h"
+#include "kozos.h"
+#include "consdrv.h"
+#include "lib.h"
+#include "klog.h"
+#include "shell.h"
+
+/* リンカ・スクリプトで定義されるコマンドの表(名前順) */
+extern const shell_command_t _shell_commands[], _eshell_commands[];
+#define SHELL_COMMAND_NUM (_eshell_commands - _shell_commands)
+
+static int shell_sorted; /* 表が名前順に並んでいるか */
+
+/*
+ * １回の出力の依頼で送る最大長．
+ * メッセージの領域がメモリ・プールの小さいブロックに収まるように分割する．
+ */
+#define SHELL_WRITE_SIZE 48
+
+/* コンソール・ドライバの使用開始をコンソール・ドライバに依頼する */
+void shell_use(int index)
+{
+  char *p;
+  p = kz_kmalloc(3);
+  p[0] = '0';
+  p[1] = CONSDRV_CMD_USE;
+  p[2] = '0' + index;
+  kz_send(MSGBOX_ID_CONSOUTPUT, 3, p);
+}
+
+/* コンソールへの文字列出力をコンソール・ドライバに依頼する */
+void shell_write(char *str)
+{
+  char *p;
+  int len, n;
+
+  for (len = strlen(str); len > 0; len -= n, str += n) {
+    n = (len > SHELL_WRITE_SIZE) ? SHELL_WRITE_SIZE : len;
+    p = kz_kmalloc(n + 2);
+    p[0] = '0';
+    p[1] = CONSDRV_CMD_WRITE;
+    memcpy(&p[2], str, n);
+    kz_send(MSGBOX_ID_CONSOUTPUT, n + 2, p);
+  }
+}
+
+/* 数値(16進)の出力をコンソール・ドライバに依頼する */
+void shell_xval(unsigned long value, int column)
+{
+  char buf[9];
+  sputxval(buf, value, column);
+  shell_write(buf);
+}
+
+/*
+ * シリアルの占有の開始/終了をコンソール・ドライバに依頼する．
+ * 送信中の出力が終わってから返るように，kz_call() で応答を待つ．
+ */
+void shell_lock(int lock)
+{
+  char *p;
+  int size;
+  p = kz_kmalloc(3);
+  p[0] = '0';
+  p[1] = CONSDRV_CMD_LOCK;
+  p[2] = lock ? '1' : '0';
+  kz_call(MSGBOX_ID_CONSOUTPUT, 3, p, &size, &p);
+}
+
+/*
+ * コマンドの表の検査．
+ * 表はリンカが並べるので，リンカ・スクリプトの誤りなどで名前順に
+ * なっていない場合は，ログに出力して線形探索にする．
+ */
+void shell_init(void)
+{
+  int i;
+
+  shell_sorted = 1;
+  for (i = 1; i < SHELL_COMMAND_NUM; i++) {
+    if (strcmp(_shell_commands[i - 1].name, _shell_commands[i].name) >= 0) {
+      kprintf(KLOG_ERR, "shell: command table is not sorted (%s)\n",
+	      _shell_commands[i].name);
+      shell_sorted = 0;
+      break;
+    }
+  }
+}
+
+static const shell_command_t *shell_find(const char *name)
+{
+  int lo, hi, mid, ret;
+
+  if (!shell_sorted) {
+    for (lo = 0; lo < SHELL_COMMAND_NUM; lo++) {
+      if (!strcmp(name, _shell_commands[lo].name))
+	return &_shell_commands[lo];
+    }
+    return NULL;
+  }
+
+  lo = 0;
+  hi = SHELL_COMMAND_NUM;
+  while (lo < hi) {
+    mid = (lo + hi) >> 1;
+    ret = strcmp(name, _shell_commands[mid].name);
+    if (!ret)
+      return &_shell_commands[mid];
+    if (ret < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return NULL;
+}
+
+/*
+ * 空白(スペースとタブ)で区切って argv[] に格納し，引数の数を返す．
+ * "..." で囲むと空白を含む引数にできる．line は区切りの位置で書き換える．
+ * 引数が多すぎる場合は-1を返す．
+ */
+int shell_parse(char *line, char *argv[], int num)
+{
+  int argc = 0;
+
+  while (1) {
+    while ((*line == ' ') || (*line == '\t'))
+      *(line++) = '\0';
+    if (*line == '\0')
+      break;
+    if (argc == num - 1) /* 終端のNULLのぶんを残す */
+      return -1;
+
+    if (*line == '"') {
+      argv[argc++] = ++line;
+      while (*line && (*line != '"'))
+	line++;
+      if (*line)
+	*(line++) = '\0';
+    } else {
+      argv[argc++] = line;
+      while (*line && (*line != ' ') && (*line != '\t'))
+	line++;
+    }
+  }
+  argv[argc] = NULL;
+
+  return argc;
+}
+
+int shell_exec(char *line)
+{
+  char *argv[SHELL_ARGV_NUM];
+  const shell_command_t *cmd;
+  int argc;
+
+  argc = shell_parse(line, argv, SHELL_ARGV_NUM);
+  if (argc < 0) {
+    shell_write("too many arguments.\n");
+    return -1;
+  }
+  if (argc == 0)
+    return 0;
+
+  cmd = shell_find(argv[0]);
+  if (cmd == NULL) {
+    shell_write("unknown.\n");
+    return -1;
+  }
+
+  return cmd->func(argc, argv);
+}
+
+/* 10進，または 0x で始まる16進の数値を変換する(割算は使わない) */
+int shell_strtoul(const char *s, uint32 *value)
+{
+  uint32 v = 0;
+  int d;
+
+  if ((s[0] == '0') && ((s[1] == 'x') || (s[1] == 'X'))) {
+    for (s += 2; *s; s++) {
+      if ((*s >= '0') && (*s <= '9'))      d = *s - '0';
+      else if ((*s >= 'a') && (*s <= 'f')) d = *s - 'a' + 10;
+      else if ((*s >= 'A') && (*s <= 'F')) d = *s - 'A' + 10;
+      else return -1;
+      v = (v << 4) | d;
+    }
+  } else {
+    if (!*s)
+      return -1;
+    for (; *s; s++) {
+      if ((*s < '0') || (*s > '9'))
+	return -1;
+      v = v * 10 + (*s - '0');
+    }
+  }
+
+  *value = v;
+  return 0;
+}
+
+/* helpコマンド(登録されているコマンドの一覧) */
+static int help_command(int argc, char *argv[])
+{
+  const shell_command_t *cmd;
+
+  for (cmd = _shell_commands; cmd < _eshell_commands; cmd++) {
+    if ((argc > 1) && strcmp(argv[1], cmd->name))
+      continue;
+    shell_write((char *)cmd->name);
+    shell_write(" ");
+    shell_write((char *)cmd->help);
+    shell_write("\n");
+  }
+  return 0;
+}
+
+SHELL_COMMAND(help, help_command, "[command] - list the commands");
@@ -0,0 +1,35 @@
+#ifndef _SHELL_H_INCLUDED_
+#define _SHELL_H_INCLUDED_
+
+/*
+ * コマンド・シェル．
+ * コマンドは各モジュールが SHELL_COMMAND() で登録する．登録したコマンドは
+ * リンカで .shell_command.<名前> セクションを名前順に並べて表にするので，
+ * 登録のための初期化処理は不要で，名前は二分探索で検索できる．
+ */
+
+typedef struct {
+  const char *name;
+  kz_func_t func;   /* int func(int argc, char *argv[]) */
+  const char *help; /* helpコマンドで表示する引数と説明 */
+} shell_command_t;
+
+#define SHELL_COMMAND(name, func, help) \
+  static const shell_command_t _shell_command_##name \
+  __attribute__((used, section(".shell_command." #name), aligned(4))) = \
+  { #name, func, help }
+
+#define SHELL_ARGV_NUM 8 /* 引数の最大数(コマンド名を含む) */
+
+void shell_init(void); /* コマンドの表の検査 */
+int shell_exec(char *line); /* １行を引数に分けてコマンドを実行する */
+int shell_parse(char *line, char *argv[], int num); /* 引数に分ける */
+int shell_strtoul(const char *s, uint32 *value); /* 数値の変換(10進/16進) */
+
+/* コンソール・ドライバへの出力の依頼(コマンドの実装から使う) */
+void shell_use(int index); /* コンソールの使用開始 */
+void shell_write(char *str); /* 文字列の出力 */
+void shell_xval(unsigned long value, int column); /* 数値(16進)の出力 */
+void shell_lock(int lock); /* シリアルの占有の開始/終了 */
+
+#endif
@@ -0,0 +1,165 @@
+#include "defines.h"
+#include "smp.h"
+#include "timer.h"
+#include "lib.h"
+#include "latency.h"
+#include "rpi_peripherals.h"
+
+#if KZ_CPU_NUM > 1
+
+/*
+ * スピンロックの獲得．
+ * 他のコアが保持している間は WFE で待ち，解放時の SEV で再試行する．
+ * (LDREX/STREX はMMUとキャッシュが無効だと実機では排他が効かないので，
+ * 実機で動かす場合はMMUを有効にしておくこと．QEMUでは問題無い)
+ */
+void spin_lock(kz_spinlock_t *lock)
+{
+  uint32 tmp;
+
+  asm volatile (
+    "1:	ldrex	%0, [%1]\n"
+    "	teq	%0, #0\n"
+    "	wfene\n"
+    "	strexeq	%0, %2, [%1]\n"
+    "	teqeq	%0, #0\n"
+    "	bne	1b\n"
+    "	dmb\n"
+    : "=&r" (tmp)
+    : "r" (&lock->locked), "r" (1)
+    : "cc", "memory");
+}
+
+/* スピンロックの解放(待っているコアを SEV で起こす) */
+void spin_unlock(kz_spinlock_t *lock)
+{
+  asm volatile (
+    "	dmb\n"
+    "	str	%1, [%0]\n"
+    "	dsb\n"
+    "	sev\n"
+    :
+    : "r" (&lock->locked), "r" (0)
+    : "memory");
+}
+
+/*
+ * セカンダリ・コアの起動．
+ * ファームウエアのスピン・テーブルで，各コアは自分のメールボックス3に
+ * アドレスが書き込まれるのを待っているので，起動アドレスを書き込む．
+ */
+void smp_boot_secondary(void)
+{
+  extern char _start_secondary;
+  int cpu;
+
+  for (cpu = 1; cpu < KZ_CPU_NUM; cpu++)
+    *CORE_MBOX_SET(cpu, 3) = (uint32)&_start_secondary;
+  asm volatile ("dsb\n\tsev" : : : "memory");
+}
+
+/* 送信前の要求(送信元のコア，宛先のコアごと) */
+static uint32 ipi_pending[KZ_CPU_NUM][KZ_CPU_NUM];
+
+/* 宛先のメールボックスが空の状態から最初に送信した時刻 */
+static uint32 ipi_stamps[KZ_CPU_NUM];
+
+static ipi_stat_t ipi_stats[KZ_CPU_NUM];
+
+/* 要因の処理(TLBとキャッシュの操作のみ．再スケジューリングは呼び出し元で行う) */
+static void ipi_maintenance(uint32 reasons)
+{
+  if (reasons & IPI_TLB_FLUSH)
+    asm volatile ("mcr p15, 0, %0, c8, c7, 0" : : "r" (0) : "memory");
+  if (reasons & IPI_ICACHE_FLUSH) {
+    asm volatile ("mcr p15, 0, %0, c7, c5, 0" : : "r" (0) : "memory");
+    asm volatile ("mcr p15, 0, %0, c7, c5, 6" : : "r" (0) : "memory");
+  }
+  if (reasons & (IPI_TLB_FLUSH | IPI_ICACHE_FLUSH))
+    asm volatile ("dsb\n\tisb" : : : "memory");
+}
+
+/* 動作中のコアのメールボックス0の割込みを有効にする */
+void ipi_init(void)
+{
+  *CORE_MBOX_RDCLR(cpu_id(), 0) = 0xffffffff;
+  *CORE_MBOX_INTCTL(cpu_id()) = CORE_MBOX_INTCTL_MBOX0;
+}
+
+/*
+ * 要求の登録．動作中のコア宛てならば，割込みを使わずにその場で処理する．
+ * (再スケジューリングは，カーネル処理の終了時に必ず行われる)
+ */
+void ipi_request(int cpu, uint32 reasons)
+{
+  ipi_stats[cpu_id()].requests++;
+  if (cpu == cpu_id())
+    ipi_maintenance(reasons);
+  else
+    ipi_pending[cpu_id()][cpu] |= reasons;
+}
+
+/*
+ * 登録した要求の送信．
+ * メールボックスのセット・レジスタはビットのORになるので，宛先が
+ * まだ処理していない要求とも1回の割込みにまとめられる．
+ */
+void ipi_flush(void)
+{
+  uint32 *pending = ipi_pending[cpu_id()];
+  int cpu;
+
+  for (cpu = 0; cpu < KZ_CPU_NUM; cpu++) {
+    if (!pending[cpu])
+      continue;
+    if (!*CORE_MBOX_RDCLR(cpu, 0))
+      ipi_stamps[cpu] = timer_get();
+    asm volatile ("dsb" : : : "memory"); /* キューの更新を先に見せる */
+    *CORE_MBOX_SET(cpu, 0) = pending[cpu];
+    pending[cpu] = 0;
+    ipi_stats[cpu_id()].sent++;
+  }
+}
+
+int ipi_raised(void)
+{
+  return (*CORE_IRQ_SOURCE(cpu_id()) & CORE_IRQ_SOURCE_MBOX0) ? 1 : 0;
+}
+
+/* 受信した要因をクリアして処理し，要因を返す */
+uint32 ipi_receive(void)
+{
+  ipi_stat_t *stat = &ipi_stats[cpu_id()];
+  uint32 reasons;
+  int i;
+
+  reasons = *CORE_MBOX_RDCLR(cpu_id(), 0);
+  *CORE_MBOX_RDCLR(cpu_id(), 0) = reasons;
+  latency_record(LATENCY_IPI, ipi_stamps[cpu_id()]);
+
+  stat->received++;
+  for (i = 0; i < IPI_REASON_NUM; i++) {
+    if (reasons & (1 << i))
+      stat->reasons[i]++;
+  }
+  ipi_maintenance(reasons);
+
+  return reasons;
+}
+
+int ipi_get_stat(int cpu, ipi_stat_t *stat)
+{
+  if ((cpu < 0) || (cpu >= KZ_CPU_NUM))
+    return -1;
+  memcpy(stat, &ipi_stats[cpu], sizeof(*stat));
+  return 0;
+}
+
+#else
+
+int ipi_get_stat(int cpu, ipi_stat_t *stat)
+{
+  return -1;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef _SMP_H_INCLUDED_
+#define _SMP_H_INCLUDED_
+
+/*
+ * マルチコア対応．
+ * KZ_CPU_NUM はMakefileのボード指定で与える．(省略時はシングル・コア)
+ * (アセンブラからも参照するので，定数の定義は __ASSEMBLER__ の外に置く)
+ */
+#ifndef KZ_CPU_NUM
+#define KZ_CPU_NUM 1
+#endif
+
+#ifndef __ASSEMBLER__
+
+#if KZ_CPU_NUM > 1
+
+/* 動作中のコアの番号(MPIDRの下位2ビット) */
+#define cpu_id() ({ \
+  uint32 _mpidr; \
+  asm volatile ("mrc p15, 0, %0, c0, c0, 5" : "=r" (_mpidr)); \
+  (int)(_mpidr & 3); })
+
+#else
+
+#define cpu_id() 0
+
+#endif
+
+/*
+ * スピンロック．(LDREX/STREX による)
+ * 割込み禁止の状態で獲得し，保持したまま割込みを許可しないこと．
+ */
+typedef struct {
+  volatile uint32 locked;
+} kz_spinlock_t;
+
+/*
+ * メモリ・バリア．
+ * ロックを使わずに他のコアと共有するデータの読み書きの順序付けに使う．
+ * (シングル・コアではコンパイラによる並べ替えのみ抑止すればよい)
+ */
+#if KZ_CPU_NUM > 1
+#define smp_mb() asm volatile ("dmb" : : : "memory")
+#else
+#define smp_mb() asm volatile ("" : : : "memory")
+#endif
+
+/*
+ * プロセッサ間割込み(IPI)の要因．
+ * 要因はビットで表し，受信側が処理する前に届いた要求は1回の割込みに
+ * まとめられる．
+ */
+#define IPI_RESCHEDULE   (1 << 0) /* スケジューリングのやり直し */
+#define IPI_TLB_FLUSH    (1 << 1) /* TLBの無効化 */
+#define IPI_ICACHE_FLUSH (1 << 2) /* 命令キャッシュと分岐予測の無効化 */
+#define IPI_REASON_NUM   3
+
+/* プロセッサ間割込みの統計(コアごと) */
+typedef struct {
+  uint32 requests; /* 要求の数(まとめられる前) */
+  uint32 sent;     /* 送信した割込みの数 */
+  uint32 received; /* 受信した割込みの数 */
+  uint32 reasons[IPI_REASON_NUM]; /* 受信した要因ごとの数 */
+} ipi_stat_t;
+
+#if KZ_CPU_NUM > 1
+void spin_lock(kz_spinlock_t *lock);
+void spin_unlock(kz_spinlock_t *lock);
+void smp_boot_secondary(void); /* セカンダリ・コアの起動 */
+
+/*
+ * プロセッサ間割込み．(いずれもカーネル・ロックを獲得して呼ぶこと)
+ * ipi_request() で要求した要因はコアごとに溜めておき，ipi_flush() で
+ * 宛先のコアごとに1回の割込みとして送信する．
+ */
+void ipi_init(void); /* 動作中のコアでの受信の開始 */
+void ipi_request(int cpu, uint32 reasons); /* 要求の登録 */
+void ipi_flush(void); /* 登録した要求の送信 */
+int ipi_raised(void); /* 動作中のコアへの割込みが発生しているか */
+uint32 ipi_receive(void); /* 受信した要因の処理 */
+#else
+#define spin_lock(lock)   ((void)(lock))
+#define spin_unlock(lock) ((void)(lock))
+#define smp_boot_secondary()
+#define ipi_init()
+#define ipi_request(cpu, reasons) ((void)(cpu), (void)(reasons))
+#define ipi_flush()
+#endif
+
+int ipi_get_stat(int cpu, ipi_stat_t *stat); /* 統計の取得 */
+
+#endif /* __ASSEMBLER__ */
+
+#endif
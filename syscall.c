@@ -15,6 +15,23 @@ kz_thread_id_t kz_run(kz_func_t func, char *name, int priority, int stacksize,
   param.un.run.stacksize = stacksize;
   param.un.run.argc = argc;
   param.un.run.argv = argv;
+  param.un.run.affinity = KZ_AFFINITY_ANY;
+  kz_syscall(KZ_SYSCALL_TYPE_RUN, &param);
+  return param.un.run.ret;
+}
+
+kz_thread_id_t kz_run_affinity(kz_func_t func, char *name, int priority,
+			       int stacksize, int argc, char *argv[],
+			       uint32 affinity)
+{
+  kz_syscall_param_t param;
+  param.un.run.func = func;
+  param.un.run.name = name;
+  param.un.run.priority = priority;
+  param.un.run.stacksize = stacksize;
+  param.un.run.argc = argc;
+  param.un.run.argv = argv;
+  param.un.run.affinity = affinity;
   kz_syscall(KZ_SYSCALL_TYPE_RUN, &param);
   return param.un.run.ret;
 }
@@ -78,9 +95,15 @@ int kz_kmfree(void *p)
 }
 
 int kz_send(kz_msgbox_id_t id, int size, char *p)
+{
+  return kz_send_pri(id, -1, size, p);
+}
+
+int kz_send_pri(kz_msgbox_id_t id, int priority, int size, char *p)
 {
   kz_syscall_param_t param;
   param.un.send.id = id;
+  param.un.send.priority = priority;
   param.un.send.size = size;
   param.un.send.p = p;
   kz_syscall(KZ_SYSCALL_TYPE_SEND, &param);
@@ -97,6 +120,188 @@ kz_thread_id_t kz_recv(kz_msgbox_id_t id, int *sizep, char **pp)
   return param.un.recv.ret;
 }
 
+int kz_sendv(kz_msgbox_id_t id, kz_msgvec_t *vec, int num)
+{
+  kz_syscall_param_t param;
+  param.un.sendv.id = id;
+  param.un.sendv.vec = vec;
+  param.un.sendv.num = num;
+  kz_syscall(KZ_SYSCALL_TYPE_SENDV, &param);
+  return param.un.sendv.ret;
+}
+
+int kz_recvv(kz_msgbox_id_t id, kz_msgvec_t *vec, int num)
+{
+  kz_syscall_param_t param;
+  param.un.recvv.id = id;
+  param.un.recvv.vec = vec;
+  param.un.recvv.num = num;
+  kz_syscall(KZ_SYSCALL_TYPE_RECVV, &param);
+  return param.un.recvv.ret;
+}
+
+int kz_call(kz_msgbox_id_t id, int size, char *p, int *rsizep, char **rpp)
+{
+  kz_syscall_param_t param;
+  param.un.call.id = id;
+  param.un.call.size = size;
+  param.un.call.p = p;
+  param.un.call.rsizep = rsizep;
+  param.un.call.rpp = rpp;
+  kz_syscall(KZ_SYSCALL_TYPE_CALL, &param);
+  return param.un.call.ret;
+}
+
+int kz_reply(kz_thread_id_t id, int size, char *p)
+{
+  kz_syscall_param_t param;
+  param.un.reply.id = id;
+  param.un.reply.size = size;
+  param.un.reply.p = p;
+  kz_syscall(KZ_SYSCALL_TYPE_REPLY, &param);
+  return param.un.reply.ret;
+}
+
+int kz_select(kz_msgbox_id_t *ids, int num, uint32 *readyp)
+{
+  kz_syscall_param_t param;
+  param.un.select.ids = ids;
+  param.un.select.num = num;
+  param.un.select.readyp = readyp;
+  param.un.select.wait = 1;
+  kz_syscall(KZ_SYSCALL_TYPE_SELECT, &param);
+  return param.un.select.ret;
+}
+
+int kz_poll(kz_msgbox_id_t *ids, int num, uint32 *readyp)
+{
+  kz_syscall_param_t param;
+  param.un.select.ids = ids;
+  param.un.select.num = num;
+  param.un.select.readyp = readyp;
+  param.un.select.wait = 0;
+  kz_syscall(KZ_SYSCALL_TYPE_SELECT, &param);
+  return param.un.select.ret;
+}
+
+kz_sem_id_t kz_sem_create(int count)
+{
+  kz_syscall_param_t param;
+  param.un.sem.count = count;
+  kz_syscall(KZ_SYSCALL_TYPE_SEM_CREATE, &param);
+  return param.un.sem.ret;
+}
+
+int kz_sem_wait(kz_sem_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.sem.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_SEM_WAIT, &param);
+  return param.un.sem.ret;
+}
+
+int kz_sem_post(kz_sem_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.sem.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_SEM_POST, &param);
+  return param.un.sem.ret;
+}
+
+kz_mutex_id_t kz_mutex_create(void)
+{
+  kz_syscall_param_t param;
+  kz_syscall(KZ_SYSCALL_TYPE_MUTEX_CREATE, &param);
+  return param.un.mutex.ret;
+}
+
+int kz_mutex_lock(kz_mutex_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.mutex.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_MUTEX_LOCK, &param);
+  return param.un.mutex.ret;
+}
+
+int kz_mutex_unlock(kz_mutex_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.mutex.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_MUTEX_UNLOCK, &param);
+  return param.un.mutex.ret;
+}
+
+kz_flag_id_t kz_flag_create(uint32 pattern)
+{
+  kz_syscall_param_t param;
+  param.un.flag.pattern = pattern;
+  kz_syscall(KZ_SYSCALL_TYPE_FLAG_CREATE, &param);
+  return param.un.flag.ret;
+}
+
+uint32 kz_flag_wait(kz_flag_id_t id, uint32 pattern, int mode)
+{
+  kz_syscall_param_t param;
+  param.un.flag.id = id;
+  param.un.flag.pattern = pattern;
+  param.un.flag.mode = mode;
+  kz_syscall(KZ_SYSCALL_TYPE_FLAG_WAIT, &param);
+  return param.un.flag.ret;
+}
+
+int kz_flag_set(kz_flag_id_t id, uint32 pattern)
+{
+  kz_syscall_param_t param;
+  param.un.flag.id = id;
+  param.un.flag.pattern = pattern;
+  kz_syscall(KZ_SYSCALL_TYPE_FLAG_SET, &param);
+  return param.un.flag.ret;
+}
+
+int kz_flag_clear(kz_flag_id_t id, uint32 pattern)
+{
+  kz_syscall_param_t param;
+  param.un.flag.id = id;
+  param.un.flag.pattern = pattern;
+  kz_syscall(KZ_SYSCALL_TYPE_FLAG_CLEAR, &param);
+  return param.un.flag.ret;
+}
+
+int kz_edf(uint32 period, uint32 budget, uint32 deadline)
+{
+  kz_syscall_param_t param;
+  param.un.edf.period = period;
+  param.un.edf.budget = budget;
+  param.un.edf.deadline = deadline;
+  kz_syscall(KZ_SYSCALL_TYPE_EDF, &param);
+  return param.un.edf.ret;
+}
+
+int kz_edf_wait(void)
+{
+  kz_syscall_param_t param;
+  kz_syscall(KZ_SYSCALL_TYPE_EDF_WAIT, &param);
+  return param.un.edf_wait.ret;
+}
+
+int kz_ipi(uint32 cpumask, uint32 reasons)
+{
+  kz_syscall_param_t param;
+  param.un.ipi.cpumask = cpumask;
+  param.un.ipi.reasons = reasons;
+  kz_syscall(KZ_SYSCALL_TYPE_IPI, &param);
+  return param.un.ipi.ret;
+}
+
+int kz_threadinfo(int index, kz_threadinfo_t *info)
+{
+  kz_syscall_param_t param;
+  param.un.threadinfo.index = index;
+  param.un.threadinfo.info = info;
+  kz_syscall(KZ_SYSCALL_TYPE_THREADINFO, &param);
+  return param.un.threadinfo.ret;
+}
+
 int kz_setintr(softvec_type_t type, kz_handler_t handler)
 {
   kz_syscall_param_t param;
@@ -106,6 +311,63 @@ int kz_setintr(softvec_type_t type, kz_handler_t handler)
   return param.un.setintr.ret;
 }
 
+kz_msgbox_id_t kz_msgbox_create(int attr)
+{
+  kz_syscall_param_t param;
+  param.un.msgbox_create.attr = attr;
+  kz_syscall(KZ_SYSCALL_TYPE_MSGBOX_CREATE, &param);
+  return param.un.msgbox_create.ret;
+}
+
+int kz_msgbox_destroy(kz_msgbox_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.msgbox_destroy.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_MSGBOX_DESTROY, &param);
+  return param.un.msgbox_destroy.ret;
+}
+
+kz_ring_id_t kz_ring_create(int slotsize, int slotnum)
+{
+  kz_syscall_param_t param;
+  param.un.ring_create.slotsize = slotsize;
+  param.un.ring_create.slotnum = slotnum;
+  kz_syscall(KZ_SYSCALL_TYPE_RING_CREATE, &param);
+  return param.un.ring_create.ret;
+}
+
+void *kz_ring_reserve(kz_ring_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.ring_reserve.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_RING_RESERVE, &param);
+  return param.un.ring_reserve.ret;
+}
+
+int kz_ring_commit(kz_ring_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.ring_commit.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_RING_COMMIT, &param);
+  return param.un.ring_commit.ret;
+}
+
+void *kz_ring_peek(kz_ring_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.ring_peek.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_RING_PEEK, &param);
+  return param.un.ring_peek.ret;
+}
+
+int kz_ring_release(kz_ring_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.ring_release.id = id;
+  kz_syscall(KZ_SYSCALL_TYPE_RING_RELEASE, &param);
+  return param.un.ring_release.ret;
+}
+
 /* サービス・コール */
 
 int kx_wakeup(kz_thread_id_t id)
@@ -136,8 +398,26 @@ int kx_send(kz_msgbox_id_t id, int size, char *p)
 {
   kz_syscall_param_t param;
   param.un.send.id = id;
+  param.un.send.priority = -1;
   param.un.send.size = size;
   param.un.send.p = p;
   kz_srvcall(KZ_SYSCALL_TYPE_SEND, &param);
   return param.un.send.ret;
 }
+
+int kx_sem_post(kz_sem_id_t id)
+{
+  kz_syscall_param_t param;
+  param.un.sem.id = id;
+  kz_srvcall(KZ_SYSCALL_TYPE_SEM_POST, &param);
+  return param.un.sem.ret;
+}
+
+int kx_flag_set(kz_flag_id_t id, uint32 pattern)
+{
+  kz_syscall_param_t param;
+  param.un.flag.id = id;
+  param.un.flag.pattern = pattern;
+  kz_srvcall(KZ_SYSCALL_TYPE_FLAG_SET, &param);
+  return param.un.flag.ret;
+}
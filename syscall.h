@@ -18,6 +18,32 @@ typedef enum {
   KZ_SYSCALL_TYPE_SEND,
   KZ_SYSCALL_TYPE_RECV,
   KZ_SYSCALL_TYPE_SETINTR,
+  KZ_SYSCALL_TYPE_SENDV,
+  KZ_SYSCALL_TYPE_RECVV,
+  KZ_SYSCALL_TYPE_SELECT,
+  KZ_SYSCALL_TYPE_CALL,
+  KZ_SYSCALL_TYPE_REPLY,
+  KZ_SYSCALL_TYPE_SEM_CREATE,
+  KZ_SYSCALL_TYPE_SEM_WAIT,
+  KZ_SYSCALL_TYPE_SEM_POST,
+  KZ_SYSCALL_TYPE_MUTEX_CREATE,
+  KZ_SYSCALL_TYPE_MUTEX_LOCK,
+  KZ_SYSCALL_TYPE_MUTEX_UNLOCK,
+  KZ_SYSCALL_TYPE_FLAG_CREATE,
+  KZ_SYSCALL_TYPE_FLAG_WAIT,
+  KZ_SYSCALL_TYPE_FLAG_SET,
+  KZ_SYSCALL_TYPE_FLAG_CLEAR,
+  KZ_SYSCALL_TYPE_THREADINFO,
+  KZ_SYSCALL_TYPE_EDF,
+  KZ_SYSCALL_TYPE_EDF_WAIT,
+  KZ_SYSCALL_TYPE_MSGBOX_CREATE,
+  KZ_SYSCALL_TYPE_MSGBOX_DESTROY,
+  KZ_SYSCALL_TYPE_RING_CREATE,
+  KZ_SYSCALL_TYPE_RING_RESERVE,
+  KZ_SYSCALL_TYPE_RING_COMMIT,
+  KZ_SYSCALL_TYPE_RING_PEEK,
+  KZ_SYSCALL_TYPE_RING_RELEASE,
+  KZ_SYSCALL_TYPE_IPI,
 } kz_syscall_type_t;
 
 /* システム・コール呼び出し時のパラメータ格納域の定義 */
@@ -30,6 +56,7 @@ typedef struct {
       int stacksize;
       int argc;
       char **argv;
+      uint32 affinity;
       kz_thread_id_t ret;
     } run;
     struct {
@@ -62,6 +89,7 @@ typedef struct {
     } kmfree;
     struct {
       kz_msgbox_id_t id;
+      int priority;
       int size;
       char *p;
       int ret;
@@ -72,11 +100,107 @@ typedef struct {
       char **pp;
       kz_thread_id_t ret;
     } recv;
+    struct {
+      kz_msgbox_id_t id;
+      kz_msgvec_t *vec;
+      int num;
+      int ret;
+    } sendv;
+    struct {
+      kz_msgbox_id_t id;
+      kz_msgvec_t *vec;
+      int num;
+      int ret;
+    } recvv;
+    struct {
+      kz_msgbox_id_t id;
+      int size;
+      char *p;
+      int *rsizep;
+      char **rpp;
+      int ret;
+    } call;
+    struct {
+      kz_thread_id_t id;
+      int size;
+      char *p;
+      int ret;
+    } reply;
+    struct {
+      kz_msgbox_id_t *ids;
+      int num;
+      uint32 *readyp;
+      int wait;
+      int ret;
+    } select;
+    struct {
+      kz_sem_id_t id;
+      int count;
+      int ret;
+    } sem;
+    struct {
+      kz_mutex_id_t id;
+      int ret;
+    } mutex;
+    struct {
+      kz_flag_id_t id;
+      uint32 pattern;
+      int mode;
+      uint32 ret;
+    } flag;
+    struct {
+      uint32 period;
+      uint32 budget;
+      uint32 deadline;
+      int ret;
+    } edf;
+    struct {
+      int ret;
+    } edf_wait;
+    struct {
+      uint32 cpumask;
+      uint32 reasons;
+      int ret;
+    } ipi;
+    struct {
+      int index;
+      kz_threadinfo_t *info;
+      int ret;
+    } threadinfo;
     struct {
       softvec_type_t type;
       kz_handler_t handler;
       int ret;
     } setintr;
+    struct {
+      int attr;
+      kz_msgbox_id_t ret;
+    } msgbox_create;
+    struct {
+      kz_msgbox_id_t id;
+      int ret;
+    } msgbox_destroy;
+    struct {
+      int slotsize;
+      int slotnum;
+      kz_ring_id_t ret;
+    } ring_create;
+    struct {
+      kz_ring_id_t id;
+      void *ret;
+    } ring_reserve;
+    struct {
+      kz_ring_id_t id;
+      int ret;
+    } ring_commit;
+    struct {
+      kz_ring_id_t id;
+      void *ret;
+    } ring_peek;
+    struct {
+      kz_ring_id_t id;
+      int ret;
+    } ring_release;
   } un;
 } kz_syscall_param_t;
 
@@ -0,0 +1,163 @@
+#include "defines.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "smp.h"
+#include "lib.h"
+#include "klog.h"
+#include "telemetry.h"
+#include "shell.h"
+
+#define TELEMETRY_HEADER_SIZE 8 /* チャネル，コア番号，通番，時刻 */
+#define TELEMETRY_RAW_SIZE   (TELEMETRY_HEADER_SIZE + TELEMETRY_DATA_SIZE + 2)
+/* COBSの符号化で1バイト，前後の区切りで2バイト増える */
+#define TELEMETRY_FRAME_SIZE (TELEMETRY_RAW_SIZE + 3)
+
+KZ_STATIC_ASSERT(TELEMETRY_RAW_SIZE < 0xff, "TELEMETRY_DATA_SIZE too large");
+KZ_STATIC_ASSERT(TELEMETRY_FRAME_SIZE <= KLOG_RECORD_SIZE,
+		 "TELEMETRY_DATA_SIZE too large");
+
+static uint16 telemetry_seqs[KZ_CPU_NUM][TELEMETRY_CH_NUM];
+
+/*
+ * フレームの組み立て領域(コアごと)．
+ * スレッドの切替えのトレースは割り込まれたスレッドのスタック上で
+ * 送信されるので，スタックには置かない．同じコアの割込みハンドラとの
+ * 排他のため，割込み禁止で使う．
+ */
+static struct {
+  uint8 raw[TELEMETRY_RAW_SIZE];
+  uint8 frame[TELEMETRY_FRAME_SIZE];
+} telemetry_bufs[KZ_CPU_NUM];
+uint32 telemetry_trace_mask;
+
+static void telemetry_put32(uint8 *p, uint32 value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+  p[2] = value >> 16;
+  p[3] = value >> 24;
+}
+
+/*
+ * COBS(Consistent Overhead Byte Stuffing)による符号化．
+ * 0x00を含まない列に変換する．各ブロックの先頭に，次の0x00(または
+ * ブロックの終わり)までの距離を置く．符号化後の長さを返す．
+ */
+static int cobs_encode(uint8 *dst, const uint8 *src, int len)
+{
+  int i, code_pos = 0, n = 1;
+  uint8 code = 1;
+
+  for (i = 0; i < len; i++) {
+    if (src[i]) {
+      dst[n++] = src[i];
+      code++;
+    }
+    if (!src[i] || (code == 0xff)) {
+      dst[code_pos] = code;
+      code_pos = n++;
+      code = 1;
+    }
+  }
+  dst[code_pos] = code;
+
+  return n;
+}
+
+int telemetry_send(int channel, const void *data, int len)
+{
+  uint8 *raw, *frame;
+  uint32 cpsr;
+  uint16 crc, seq;
+  int cpu, n;
+
+  if ((channel < 0) || (channel >= TELEMETRY_CH_NUM) ||
+      (len < 0) || (len > TELEMETRY_DATA_SIZE))
+    return -1;
+
+  INTR_SAVE(cpsr);
+  cpu = cpu_id();
+  raw = telemetry_bufs[cpu].raw;
+  frame = telemetry_bufs[cpu].frame;
+  seq = telemetry_seqs[cpu][channel]++;
+
+  raw[0] = channel;
+  raw[1] = cpu;
+  raw[2] = seq;
+  raw[3] = seq >> 8;
+  telemetry_put32(&raw[4], timer_get());
+  memcpy(&raw[TELEMETRY_HEADER_SIZE], data, len);
+  len += TELEMETRY_HEADER_SIZE;
+  crc = crc16(0, raw, len);
+  raw[len++] = crc;
+  raw[len++] = crc >> 8;
+
+  frame[0] = 0x00;
+  n = 1 + cobs_encode(&frame[1], raw, len);
+  frame[n++] = 0x00;
+
+  n = klog_write(frame, n);
+  INTR_RESTORE(cpsr);
+
+  return n;
+}
+
+int telemetry_counters(uint32 id, const uint32 *values, int num)
+{
+  uint8 data[TELEMETRY_DATA_SIZE];
+  int i;
+
+  if ((num < 0) || ((num + 1) * 4 > TELEMETRY_DATA_SIZE))
+    return -1;
+
+  telemetry_put32(&data[0], id);
+  for (i = 0; i < num; i++)
+    telemetry_put32(&data[(i + 1) * 4], values[i]);
+
+  return telemetry_send(TELEMETRY_CH_COUNTER, data, (num + 1) * 4);
+}
+
+int telemetry_trace(uint32 event, uint32 arg)
+{
+  uint8 data[8];
+  telemetry_put32(&data[0], event);
+  telemetry_put32(&data[4], arg);
+  return telemetry_send(TELEMETRY_CH_TRACE, data, sizeof(data));
+}
+
+int telemetry_sample(uint32 id, uint32 value)
+{
+  uint8 data[8];
+  telemetry_put32(&data[0], id);
+  telemetry_put32(&data[4], value);
+  return telemetry_send(TELEMETRY_CH_SAMPLE, data, sizeof(data));
+}
+
+/*
+ * traceコマンド(カーネル内のトレースの開始/停止)
+ * "trace on", "trace off" または有効にするイベントのビットを指定する．
+ */
+static int trace_command(int argc, char *argv[])
+{
+  uint32 mask;
+
+  if (argc > 1) {
+    if (!strcmp(argv[1], "on")) {
+      mask = ((uint32)1 << TELEMETRY_TRACE_NUM) - 1;
+    } else if (!strcmp(argv[1], "off")) {
+      mask = 0;
+    } else if (shell_strtoul(argv[1], &mask) < 0) {
+      shell_write("trace: invalid mask.\n");
+      return -1;
+    }
+    telemetry_trace_mask = mask;
+  }
+
+  shell_write("trace mask ");
+  shell_xval(telemetry_trace_mask, 0);
+  shell_write("\n");
+
+  return 0;
+}
+
+SHELL_COMMAND(trace, trace_command, "[on|off|mask] - kernel trace frames");
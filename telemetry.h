@@ -0,0 +1,42 @@
+#ifndef _TELEMETRY_H_INCLUDED_
+#define _TELEMETRY_H_INCLUDED_
+
+/*
+ * テレメトリ(コンソールのシリアルに多重化するバイナリのフレーム)．
+ *
+ * フレームの内容(リトル・エンディアン)
+ *   チャネル(1) コア番号(1) 通番(2) 時刻(4, us) データ(0〜TELEMETRY_DATA_SIZE)
+ *   CRC(2, CRC-16/XMODEM, チャネルからデータまで)
+ * これをCOBSで符号化して，前後に区切りの0x00を付けて送信する．
+ * テキストの出力には0x00が現れないので，受信側は0x00から次の0x00までを
+ * フレームとして取り出せる．(tools/telemetry_decode.py を参照)
+ * 通番はコアとチャネルごとに増えるので，受信側でフレームの欠落がわかる．
+ *
+ * フレームはカーネルのログと同じバッファを通して送信されるので，
+ * 割込みハンドラからも送信できて，待たされることは無い．
+ * (バッファが一杯ならばフレームを捨てて，ログの統計の dropped に数える)
+ */
+
+#define TELEMETRY_CH_COUNTER 0 /* カウンタの組(識別子と値の配列) */
+#define TELEMETRY_CH_TRACE   1 /* トレースのレコード(イベントと引数) */
+#define TELEMETRY_CH_SAMPLE  2 /* サンプル値(識別子と値) */
+#define TELEMETRY_CH_NUM     3
+
+/*
+ * カーネル内のトレースのイベント(telemetry_trace() の event)．
+ * 有効にしたイベントのみ記録する．(traceコマンドで切り替える)
+ */
+#define TELEMETRY_TRACE_SWITCH 0 /* スレッドの切替え(引数は切替え先のID) */
+#define TELEMETRY_TRACE_NUM    1
+
+extern uint32 telemetry_trace_mask; /* 有効なイベント(ビット) */
+#define telemetry_traced(event) (telemetry_trace_mask & ((uint32)1 << (event)))
+
+int telemetry_send(int channel, const void *data, int len);
+
+/* 以下はデータを32ビットの値の並びとして送信する(先頭は識別子) */
+int telemetry_counters(uint32 id, const uint32 *values, int num);
+int telemetry_trace(uint32 event, uint32 arg);
+int telemetry_sample(uint32 id, uint32 value);
+
+#endif
@@ -0,0 +1,46 @@
+#include "defines.h"
+#include "timer.h"
+#include "rpi_peripherals.h"
+#include "intr.h"
+#include "interrupt.h"
+
+/*
+ * ティック割込みにはシステム・タイマのコンペア1(IRQ1)を使う．
+ * (コンペア0と2はGPUが使用している)
+ */
+#define TIMER_TICK_IRQ     1
+#define TIMER_TICK_MATCH   (1 << 1) /* SYST_CS の M1 */
+
+/*
+ * フリーランニング・カウンタの取得．
+ * システム・タイマの下位32ビット(1MHz)をそのまま返すので，
+ * 経過時間は差分をとればマイクロ秒単位になる．
+ */
+uint32 timer_get(void)
+{
+  return *SYST_CLO;
+}
+
+/* ティック割込みの開始(最も優先度の高い割込みとする) */
+void timer_tick_init(void)
+{
+  *SYST_C1 = *SYST_CLO + TIMER_TICK_USEC;
+  *SYST_CS = TIMER_TICK_MATCH;
+  intr_enable_irq(TIMER_TICK_IRQ, SOFTVEC_TYPE_TIMINTR, 0);
+}
+
+/*
+ * ティック割込みの要因をクリアし，次の割込みを設定する．
+ * 前回の設定値から周期を加えるので，割込みの遅れが累積しない．
+ * (割込みを取りこぼすほど遅れた場合は，現在時刻から設定し直す)
+ */
+void timer_tick_clear(void)
+{
+  uint32 next;
+
+  *SYST_CS = TIMER_TICK_MATCH;
+  next = *SYST_C1 + TIMER_TICK_USEC;
+  if ((long)(next - *SYST_CLO) <= 0)
+    next = *SYST_CLO + TIMER_TICK_USEC;
+  *SYST_C1 = next;
+}
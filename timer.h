@@ -0,0 +1,10 @@
+#ifndef _TIMER_H_INCLUDED_
+#define _TIMER_H_INCLUDED_
+
+#define TIMER_TICK_USEC 1000 /* ティックの周期(us) */
+
+uint32 timer_get(void); /* フリーランニング・カウンタ(1MHz)の取得 */
+void timer_tick_init(void);  /* ティック割込みの開始 */
+void timer_tick_clear(void); /* ティック割込みの要因クリアと次の設定 */
+
+#endif
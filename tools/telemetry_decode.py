@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Decoder for the kozos telemetry frames multiplexed on the console.
+
+Usage:
+  telemetry_decode.py [-b BAUD] [-q] SOURCE
+
+SOURCE is a serial port such as /dev/ttyUSB0, a capture file, or '-'
+for stdin.  Console text is passed through to stdout and each frame is
+printed on its own line starting with '#'.  With -q the text is dropped.
+
+A frame is 0x00, the COBS encoding of
+
+  channel(1) cpu(1) seq(2) time(4, us) data(n) crc(2, CRC-16/XMODEM)
+
+and a closing 0x00, all little-endian (see telemetry.h).
+"""
+
+import argparse
+import os
+import stat
+import struct
+import sys
+import termios
+
+CHANNELS = {0: 'counter', 1: 'trace', 2: 'sample'}
+COUNTERS = {0: 'latency', 1: 'klog', 2: 'ipi'}  # TM_COUNTER_* in command.c
+MAX_FRAME = 512  # give up on a frame whose closing 0x00 was lost
+
+
+def crc16(data):
+    crc = 0
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xffff
+    return crc
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xff and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def set_baud(fd, baud):
+    speed = getattr(termios, 'B%d' % baud)
+    attr = termios.tcgetattr(fd)
+    attr[0] = 0                                  # iflag
+    attr[1] = 0                                  # oflag
+    attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attr[3] = 0                                  # lflag
+    attr[4] = attr[5] = speed
+    attr[6][termios.VMIN] = 1
+    attr[6][termios.VTIME] = 0
+    termios.tcsetattr(fd, termios.TCSANOW, attr)
+
+
+class Decoder:
+    def __init__(self, out, quiet):
+        self.out = out
+        self.quiet = quiet
+        self.frame = None          # None while reading console text
+        self.seqs = {}             # (cpu, channel) -> last seq
+        self.frames = self.errors = self.lost = 0
+
+    def text(self, data):
+        if not self.quiet and data:
+            self.out.write(data.decode('ascii', 'replace'))
+
+    def feed(self, data):
+        for b in data:
+            if self.frame is None:
+                if b == 0:
+                    self.frame = bytearray()
+                else:
+                    self.text(bytes([b]))
+            elif b == 0:
+                if self.frame:     # an empty frame is a stray delimiter
+                    self.decode(bytes(self.frame))
+                self.frame = None
+            else:
+                self.frame.append(b)
+                if len(self.frame) > MAX_FRAME:
+                    self.text(bytes(self.frame))
+                    self.frame = None
+        self.out.flush()
+
+    def decode(self, encoded):
+        raw = cobs_decode(encoded)
+        if raw is None or len(raw) < 10 or \
+           crc16(raw[:-2]) != struct.unpack('<H', raw[-2:])[0]:
+            self.errors += 1
+            if all(32 <= b < 127 or b in b'\r\n\t' for b in encoded):
+                self.text(encoded)  # text after a lost delimiter
+            else:
+                self.out.write('# bad frame (%d bytes)\n' % len(encoded))
+            return
+        self.frames += 1
+        channel, cpu, seq, time = struct.unpack('<BBHI', raw[:8])
+        data = raw[8:-2]
+
+        key = (cpu, channel)
+        if key in self.seqs:
+            gap = (seq - self.seqs[key] - 1) & 0xffff
+            if gap:
+                self.lost += gap
+                self.out.write('# lost %d frame(s) on cpu%d %s\n' %
+                               (gap, cpu, CHANNELS.get(channel, channel)))
+        self.seqs[key] = seq
+
+        line = '# %-7s cpu%d seq %5d t %10dus' % (
+            CHANNELS.get(channel, 'ch%d' % channel), cpu, seq, time)
+        if len(data) % 4 == 0 and data:
+            words = struct.unpack('<%dI' % (len(data) // 4), data)
+            if channel == 0:
+                line += ' %s:' % COUNTERS.get(words[0], words[0])
+            else:
+                line += ' %d:' % words[0]
+            line += ''.join(' %d' % w for w in words[1:])
+        else:
+            line += ' ' + data.hex()
+        self.out.write(line + '\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('-b', '--baud', type=int, default=115200,
+                        help='console baud rate (SERIAL_DEFAULT_BAUD)')
+    parser.add_argument('-q', '--quiet', action='store_true',
+                        help='drop the console text')
+    parser.add_argument('source')
+    args = parser.parse_args()
+
+    if args.source == '-':
+        fd = sys.stdin.fileno()
+    else:
+        fd = os.open(args.source, os.O_RDONLY | os.O_NOCTTY)
+        if stat.S_ISCHR(os.fstat(fd).st_mode):
+            set_baud(fd, args.baud)
+
+    dec = Decoder(sys.stdout, args.quiet)
+    try:
+        while True:
+            data = os.read(fd, 4096)
+            if not data:
+                break
+            dec.feed(data)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        sys.stderr.write('%d frames, %d lost, %d bad\n' %
+                         (dec.frames, dec.lost, dec.errors))
+        if fd != sys.stdin.fileno():
+            os.close(fd)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
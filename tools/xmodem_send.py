@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""XMODEM-1K (CRC) sender for the kozos 'load' command.
+
+Usage:
+  xmodem_send.py [-b BAUD] [-C CONSOLE_BAUD] [-c] DEVICE IMAGE
+
+DEVICE is a serial port such as /dev/ttyUSB0, or the pty printed by
+'qemu-system-arm ... -serial pty'.  With -c the 'load' command is typed
+on the console first (at CONSOLE_BAUD) before switching to BAUD.
+CONSOLE_BAUD must match SERIAL_DEFAULT_BAUD in kozos_config.h.
+"""
+
+import argparse
+import os
+import sys
+import termios
+import time
+
+SOH, STX, EOT, ACK, NAK, CAN = 0x01, 0x02, 0x04, 0x06, 0x15, 0x18
+CRC = ord('C')
+CONSOLE_BAUD = 115200  # SERIAL_DEFAULT_BAUD
+RETRY = 10
+
+
+def crc16(data):
+    crc = 0
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xffff
+    return crc
+
+
+def set_baud(fd, baud):
+    speed = getattr(termios, 'B%d' % baud)
+    attr = termios.tcgetattr(fd)
+    attr[0] = 0                                  # iflag
+    attr[1] = 0                                  # oflag
+    attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attr[3] = 0                                  # lflag
+    attr[4] = attr[5] = speed
+    attr[6][termios.VMIN] = 0
+    attr[6][termios.VTIME] = 1                   # 0.1s read timeout
+    termios.tcsetattr(fd, termios.TCSADRAIN, attr)
+
+
+def read_byte(fd, timeout):
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+        b = os.read(fd, 1)
+        if b:
+            return b[0]
+    return None
+
+
+def wait_start(fd, timeout=60):
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+        b = read_byte(fd, 1)
+        if b == CRC:
+            return
+        if b == CAN:
+            raise RuntimeError('cancelled by receiver')
+    raise RuntimeError('receiver did not request CRC mode')
+
+
+def send_block(fd, num, data):
+    size = 1024 if len(data) > 128 else 128
+    data = data.ljust(size, b'\x1a')
+    crc = crc16(data)
+    packet = bytes([STX if size == 1024 else SOH, num & 0xff, ~num & 0xff])
+    packet += data + bytes([crc >> 8, crc & 0xff])
+    for _ in range(RETRY):
+        os.write(fd, packet)
+        b = read_byte(fd, 10)
+        if b == ACK:
+            return
+        if b == CAN:
+            raise RuntimeError('cancelled by receiver')
+    raise RuntimeError('block %d not acknowledged' % num)
+
+
+def send(fd, image):
+    wait_start(fd)
+    num = 1
+    for off in range(0, len(image), 1024):
+        send_block(fd, num, image[off:off + 1024])
+        num += 1
+        sys.stderr.write('\r%d/%d bytes' % (min(off + 1024, len(image)),
+                                            len(image)))
+    sys.stderr.write('\n')
+    for _ in range(RETRY):
+        os.write(fd, bytes([EOT]))
+        if read_byte(fd, 10) == ACK:
+            return
+    raise RuntimeError('EOT not acknowledged')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('-b', '--baud', type=int, default=115200)
+    parser.add_argument('-C', '--console-baud', type=int,
+                        default=CONSOLE_BAUD)
+    parser.add_argument('-c', '--command', action='store_true',
+                        help="type the 'load' command first")
+    parser.add_argument('device')
+    parser.add_argument('image')
+    args = parser.parse_args()
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+
+    fd = os.open(args.device, os.O_RDWR | os.O_NOCTTY)
+    try:
+        if args.command:
+            set_baud(fd, args.console_baud)
+            os.write(fd, b'load\r')
+            time.sleep(0.5)  # let the console echo and the banner drain
+        set_baud(fd, args.baud)
+        termios.tcflush(fd, termios.TCIFLUSH)
+        start = time.monotonic()
+        send(fd, image)
+        sys.stderr.write('sent %d bytes in %.2fs\n' %
+                         (len(image), time.monotonic() - start))
+        time.sleep(1.5)  # the receiver drains the line before switching back
+        set_baud(fd, args.console_baud)
+    except RuntimeError as e:
+        sys.stderr.write('error: %s\n' % e)
+        return 1
+    finally:
+        os.close(fd)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())